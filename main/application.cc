@@ -6,11 +6,14 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "loopback_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "audio_debugger.h"
+#include "audio_kernels.h"
+#include "latency_tracker.h"
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "afe_audio_processor.h"
@@ -18,15 +21,24 @@
 #include "no_audio_processor.h"
 #endif
 
+#include "wake_word_registry.h"
+#include "no_wake_word.h"
 #if CONFIG_USE_AFE_WAKE_WORD
 #include "afe_wake_word.h"
-#elif CONFIG_USE_ESP_WAKE_WORD
+#endif
+#if CONFIG_USE_ESP_WAKE_WORD
 #include "esp_wake_word.h"
-#else
-#include "no_wake_word.h"
+#endif
+#if CONFIG_USE_WAKE_WORD_PROFILER
+#include "wake_word_profiler.h"
+#endif
+
+#if CONFIG_USE_AUDIO_BENCHMARK
+#include "audio_benchmark.h"
 #endif
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -52,7 +64,13 @@ static const char* const STATE_STRINGS[] = {
 
 Application::Application() {
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 7);
+    background_task_ = new BackgroundTask(4096 * 2);
+#if CONFIG_FREERTOS_UNICORE
+    background_task_->ConfigureLane(kBackgroundTaskLaneEncode, "audio_encode", 4096 * 7, 2);
+#else
+    // Keep uplink encoding off core 1, where the audio loop and AFE tasks run
+    background_task_->ConfigureLane(kBackgroundTaskLaneEncode, "audio_encode", 4096 * 7, 2, 0);
+#endif
 
 #if CONFIG_USE_DEVICE_AEC
     aec_mode_ = kAecOnDeviceSide;
@@ -68,12 +86,21 @@ Application::Application() {
     audio_processor_ = std::make_unique<NoAudioProcessor>();
 #endif
 
+    auto& wake_word_registry = WakeWordRegistry::GetInstance();
 #if CONFIG_USE_AFE_WAKE_WORD
-    wake_word_ = std::make_unique<AfeWakeWord>();
-#elif CONFIG_USE_ESP_WAKE_WORD
-    wake_word_ = std::make_unique<EspWakeWord>();
-#else
-    wake_word_ = std::make_unique<NoWakeWord>();
+    wake_word_registry.Register("afe", AfeHost::GetTaskName(kAfeConsumerWakeWord), []() { return std::make_unique<AfeWakeWord>(); });
+#endif
+#if CONFIG_USE_ESP_WAKE_WORD
+    wake_word_registry.Register("esp", nullptr, []() { return std::make_unique<EspWakeWord>(); });
+#endif
+    wake_word_registry.Register("none", nullptr, []() { return std::make_unique<NoWakeWord>(); });
+    wake_word_ = wake_word_registry.CreateSelected();
+#if CONFIG_USE_WAKE_WORD_PROFILER
+    auto wake_word_name = wake_word_registry.GetSelectedName();
+    auto wake_word_profiler = std::make_unique<WakeWordProfiler>(std::move(wake_word_), wake_word_name,
+        wake_word_registry.GetProcessingTask(wake_word_name));
+    wake_word_profiler_ = wake_word_profiler.get();
+    wake_word_ = std::move(wake_word_profiler);
 #endif
 
     esp_timer_create_args_t clock_timer_args = {
@@ -153,7 +180,7 @@ void Application::CheckNewVersion() {
             codec->EnableOutput(false);
             {
                 std::lock_guard<std::mutex> lock(mutex_);
-                audio_decode_queue_.clear();
+                audio_decode_queue_.Clear();
             }
             background_task_->WaitForCompletion();
             delete background_task_;
@@ -268,15 +295,7 @@ void Application::DismissAlert() {
 }
 
 void Application::PlaySound(const std::string_view& sound) {
-    // Wait for the previous sound to finish
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        audio_decode_cv_.wait(lock, [this]() {
-            return audio_decode_queue_.empty();
-        });
-    }
-    background_task_->WaitForCompletion();
-
+    // Packets are appended behind whatever is already queued, so sounds play in order
     const char* data = sound.data();
     size_t size = sound.size();
     for (const char* p = data; p < data + size; ) {
@@ -287,13 +306,18 @@ void Application::PlaySound(const std::string_view& sound) {
         AudioStreamPacket packet;
         packet.sample_rate = 16000;
         packet.frame_duration = 60;
-        packet.payload.resize(payload_size);
-        memcpy(packet.payload.data(), p3->payload, payload_size);
+        packet.local_sound = true;
+        packet.payload = AudioPayloadPool::GetInstance().Acquire();
+        packet.payload.assign(p3->payload, p3->payload + payload_size);
         p += payload_size;
 
         std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(packet));
+        audio_decode_queue_.Push(std::move(packet), esp_timer_get_time() / 1000);
+        audio_decode_cv_.notify_all();
     }
+    // The output may have been turned off after a long silence
+    std::lock_guard<std::mutex> lock(mutex_);
+    EnableAudioOutput();
 }
 
 #ifdef CONFIG_ENABLE_AUDIO_TESTING_IN_WIFI_CONFIG
@@ -308,8 +332,12 @@ void Application::ExitAudioTestingMode() {
     SetDeviceState(kDeviceStateWifiConfiguring);
     // Copy audio_testing_queue_ to audio_decode_queue_
     std::lock_guard<std::mutex> lock(mutex_);
-    audio_decode_queue_ = std::move(audio_testing_queue_);
-    audio_decode_cv_.notify_all();
+    auto now_ms = esp_timer_get_time() / 1000;
+    for (auto& packet : audio_testing_queue_) {
+        audio_decode_queue_.Push(std::move(packet), now_ms);
+    }
+    audio_testing_queue_.clear();
+    EnableAudioOutput();
 }
 #endif
 
@@ -341,8 +369,9 @@ void Application::ToggleChatState() {
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);             
-                if (!protocol_->OpenAudioChannel()) {
+                SetDeviceState(kDeviceStateConnecting);
+                LatencyTracker::GetInstance().BeginTurn(kLatencyStageChannelOpenStart);
+                if (!OpenAudioChannel()) {
                     return;
                 }
             }
@@ -383,7 +412,8 @@ void Application::StartListening() {
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
+                LatencyTracker::GetInstance().BeginTurn(kLatencyStageChannelOpenStart);
+                if (!OpenAudioChannel()) {
                     return;
                 }
             }
@@ -433,23 +463,41 @@ void Application::Start() {
 
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
+    // Fill the payload pool before the audio tasks start allocating
+    AudioPayloadPool::GetInstance().Initialize();
+    // Local sounds are 16 kHz, create their decoder up front next to the one for the codec rate
+    opus_decoders_.push_back(std::make_unique<OpusDecoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS));
+    if (codec->output_sample_rate() != 16000) {
+        opus_decoders_.push_back(std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS));
+    }
+    opus_decoder_ = opus_decoders_.back().get();
     opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    // The governor starts from the previous fixed settings and moves within the target's budget
     if (aec_mode_ != kAecOff) {
         ESP_LOGI(TAG, "AEC mode: %d, setting opus encoder complexity to 0", aec_mode_);
-        opus_encoder_->SetComplexity(0);
+        encoder_governor_.Configure(OPUS_FRAME_DURATION_MS, 0, MAX_OPUS_COMPLEXITY_WITH_AEC);
     } else if (board.GetBoardType() == "ml307") {
         ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        encoder_governor_.Configure(OPUS_FRAME_DURATION_MS, 5, std::max(5, MAX_OPUS_COMPLEXITY));
     } else {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 0");
-        opus_encoder_->SetComplexity(0);
+        encoder_governor_.Configure(OPUS_FRAME_DURATION_MS, 0, MAX_OPUS_COMPLEXITY);
     }
+    opus_encoder_->SetComplexity(encoder_governor_.complexity());
+    uplink_dtx_ = UPLINK_DTX_ALWAYS;
+    opus_encoder_->SetDtx(uplink_dtx_);
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
+    codec->OnOutputVolumeSettled([this, codec]() {
+        if (background_task_ != nullptr) {
+            background_task_->Schedule([codec]() {
+                codec->SaveOutputVolume();
+            });
+        }
+    });
     codec->Start();
 
 #if CONFIG_USE_AUDIO_PROCESSOR
@@ -466,6 +514,13 @@ void Application::Start() {
     }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_);
 #endif
 
+    // Decoding runs in its own task so playback is not paced by the microphone reads
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->AudioOutputLoop();
+        vTaskDelete(NULL);
+    }, "audio_output", 4096 * 6, this, 4, &audio_output_task_handle_);
+
     /* Start the clock timer to update the status bar */
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
@@ -486,6 +541,9 @@ void Application::Start() {
     McpServer::GetInstance().AddCommonTools();
 #endif
 
+#if CONFIG_USE_LOOPBACK_PROTOCOL
+    protocol_ = std::make_unique<LoopbackProtocol>();
+#else
     if (ota_.HasMqttConfig()) {
         protocol_ = std::make_unique<MqttProtocol>();
     } else if (ota_.HasWebsocketConfig()) {
@@ -494,15 +552,22 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+#endif
 
     protocol_->OnNetworkError([this](const std::string& message) {
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
     protocol_->OnIncomingAudio([this](AudioStreamPacket&& packet) {
+        LatencyTracker::GetInstance().Mark(kLatencyStageFirstDownlink);
         std::lock_guard<std::mutex> lock(mutex_);
-        if (device_state_ == kDeviceStateSpeaking && audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
-            audio_decode_queue_.emplace_back(std::move(packet));
+        if (device_state_ == kDeviceStateSpeaking) {
+            if (audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
+                audio_decode_queue_.Push(std::move(packet), esp_timer_get_time() / 1000);
+                audio_decode_cv_.notify_all();
+            } else {
+                audio_decode_queue_.CountOverflow();
+            }
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -511,6 +576,11 @@ void Application::Start() {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
+#if CONFIG_UPLINK_SILENCE_DTX || CONFIG_UPLINK_SILENCE_SUPPRESS
+        if (!protocol_->CarriesAudioTimestamps()) {
+            ESP_LOGW(TAG, "The protocol carries no audio timestamps, every uplink frame will be sent");
+        }
+#endif
 
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
         auto& thing_manager = iot::ThingManager::GetInstance();
@@ -535,6 +605,7 @@ void Application::Start() {
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
             if (strcmp(state->valuestring, "start") == 0) {
+                LatencyTracker::GetInstance().Mark(kLatencyStageTtsStart);
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
@@ -543,16 +614,22 @@ void Application::Start() {
                 });
             } else if (strcmp(state->valuestring, "stop") == 0) {
                 Schedule([this]() {
-                    background_task_->WaitForCompletion();
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
+                    RunWhenAudioDrained([this]() {
+                        if (device_state_ == kDeviceStateSpeaking) {
+                            if (listening_mode_ == kListeningModeManualStop) {
+                                SetDeviceState(kDeviceStateIdle);
+                            } else {
+                                SetDeviceState(kDeviceStateListening);
+                            }
                         }
-                    }
+                    });
                 });
             } else if (strcmp(state->valuestring, "sentence_start") == 0) {
+                // The server may pause between sentences, that is not an underrun
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    audio_decode_queue_.MarkSegmentBoundary();
+                }
                 auto text = cJSON_GetObjectItem(root, "text");
                 if (cJSON_IsString(text)) {
                     ESP_LOGI(TAG, "<< %s", text->valuestring);
@@ -623,46 +700,14 @@ void Application::Start() {
     bool protocol_started = protocol_->Start();
 
     audio_debugger_ = std::make_unique<AudioDebugger>();
+    // The wake word goes first, a shared AFE pipeline only includes wakenet when the wake word creates it
+    wake_word_->Initialize(codec);
     audio_processor_->Initialize(codec);
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                ESP_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
-                return;
-            }
-        }
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                AudioStreamPacket packet;
-                packet.payload = std::move(opus);
-#ifdef CONFIG_USE_SERVER_AEC
-                {
-                    std::lock_guard<std::mutex> lock(timestamp_mutex_);
-                    if (!timestamp_queue_.empty()) {
-                        packet.timestamp = timestamp_queue_.front();
-                        timestamp_queue_.pop_front();
-                    } else {
-                        packet.timestamp = 0;
-                    }
-
-                    if (timestamp_queue_.size() > 3) { // 限制队列长度3
-                        timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
-                        return;
-                    }
-                }
-#endif
-                std::lock_guard<std::mutex> lock(mutex_);
-                if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                    ESP_LOGW(TAG, "Too many audio packets in queue, drop the oldest packet");
-                    audio_send_queue_.pop_front();
-                }
-                audio_send_queue_.emplace_back(std::move(packet));
-                xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
-            });
-        });
+        OnUplinkOutput(std::move(data));
     });
     audio_processor_->OnVadStateChange([this](bool speaking) {
+        uplink_speaking_ = speaking;
         if (device_state_ == kDeviceStateListening) {
             Schedule([this, speaking]() {
                 if (speaking) {
@@ -676,7 +721,6 @@ void Application::Start() {
         }
     });
 
-    wake_word_->Initialize(codec);
     wake_word_->OnWakeWordDetected([this](const std::string& wake_word) {
         Schedule([this, &wake_word]() {
             if (!protocol_) {
@@ -688,27 +732,48 @@ void Application::Start() {
 
                 if (!protocol_->IsAudioChannelOpened()) {
                     SetDeviceState(kDeviceStateConnecting);
-                    if (!protocol_->OpenAudioChannel()) {
+#if CONFIG_USE_AFE_WAKE_WORD
+                    // Capture what the user says right after the wake word while the channel opens,
+                    // the packets wait in the send queue until listening starts
+                    StartUplinkCapture();
+#endif
+                    if (!OpenAudioChannel()) {
+#if CONFIG_USE_AFE_WAKE_WORD
+                        StopUplinkCapture();
+#endif
                         wake_word_->StartDetection();
+                        NotifyAudioInput();
                         return;
                     }
+#if CONFIG_USE_AFE_WAKE_WORD
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (uplink_frames_dropped_ > 0) {
+                        ESP_LOGW(TAG, "Audio channel opened, %u uplink packets buffered, %u dropped while connecting",
+                            (unsigned)audio_send_queue_.size(), (unsigned)uplink_frames_dropped_);
+                    } else {
+                        ESP_LOGI(TAG, "Audio channel opened, %u uplink packets buffered", (unsigned)audio_send_queue_.size());
+                    }
+#endif
                 }
 
                 ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD
                 AudioStreamPacket packet;
+                packet.payload = AudioPayloadPool::GetInstance().Acquire();
+                std::vector<uint8_t> opus;
                 // Encode and send the wake word data to the server
-                while (wake_word_->GetWakeWordOpus(packet.payload)) {
+                while (wake_word_->GetWakeWordOpus(opus)) {
+                    packet.payload.assign(opus.begin(), opus.end());
+                    LatencyTracker::GetInstance().Mark(kLatencyStageFirstUplink);
                     protocol_->SendAudio(packet);
                 }
+                AudioPayloadPool::GetInstance().Release(std::move(packet.payload));
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
 #else
                 // Play the pop up sound to indicate the wake word is detected
-                // And wait 60ms to make sure the queue has been processed by audio task
                 ResetDecoder();
                 PlaySound(Lang::Sounds::P3_POPUP);
-                vTaskDelay(pdMS_TO_TICKS(60));
 #endif
                 SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
             } else if (device_state_ == kDeviceStateSpeaking) {
@@ -719,6 +784,7 @@ void Application::Start() {
         });
     });
     wake_word_->StartDetection();
+    NotifyAudioInput();
 
     // Wait for the new version check to finish
     xEventGroupWaitBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
@@ -733,6 +799,10 @@ void Application::Start() {
         // PlaySound(Lang::Sounds::P3_SUCCESS);        
     }
 
+#if CONFIG_USE_AUDIO_BENCHMARK
+    AudioBenchmark(CONFIG_AUDIO_BENCHMARK_ITERATIONS).Run();
+#endif
+
     // Print heap stats
     SystemInfo::PrintHeapStats();
     
@@ -740,6 +810,145 @@ void Application::Start() {
     MainEventLoop();
 }
 
+// Runs on the processor output task. The AFE hands out chunks of its own size, they are collected
+// into whole encoder frames so that every timestamp and suppression decision covers one Opus packet
+void Application::OnUplinkOutput(std::vector<int16_t>&& data) {
+    int64_t now = esp_timer_get_time();
+    if (now - uplink_frame_time_ > OPUS_FRAME_DURATION_MS * 2 * 1000) {
+        // A partial frame left from before the processor was last stopped belongs to another turn
+        uplink_frame_.clear();
+    }
+    uplink_frame_time_ = now;
+
+    size_t offset = 0;
+    while (offset < data.size()) {
+        size_t samples = std::min(data.size() - offset, UPLINK_FRAME_SAMPLES - uplink_frame_.size());
+        uplink_frame_.insert(uplink_frame_.end(), data.begin() + offset, data.begin() + offset + samples);
+        offset += samples;
+        if (uplink_frame_.size() == UPLINK_FRAME_SAMPLES) {
+            std::vector<int16_t> frame;
+            frame.reserve(UPLINK_FRAME_SAMPLES);
+            frame.swap(uplink_frame_);
+            OnUplinkFrame(std::move(frame));
+        }
+    }
+}
+
+void Application::OnUplinkFrame(std::vector<int16_t>&& frame) {
+    // The uplink clock advances for every captured frame, so suppressed frames show up as timestamp gaps
+    uint32_t timestamp = uplink_timestamp_;
+    uplink_timestamp_ += OPUS_FRAME_DURATION_MS;
+#if CONFIG_UPLINK_SILENCE_SUPPRESS
+    // Without timestamps the server could not tell a dropped frame from a spliced stream
+    if (uplink_speaking_ || aec_mode_ == kAecOnDeviceSide || !protocol_->CarriesAudioTimestamps()) {
+        uplink_hangover_frames_ = UPLINK_SILENCE_HANGOVER_MS / OPUS_FRAME_DURATION_MS;
+    } else if (uplink_hangover_frames_ > 0) {
+        uplink_hangover_frames_--;
+    } else {
+        // Keep the latest silent frame, the VAD reports speech a little after its onset
+        if (!uplink_held_frame_.empty()) {
+            uplink_frames_suppressed_++;
+        }
+        uplink_held_frame_ = std::move(frame);
+        uplink_held_timestamp_ = timestamp;
+        uplink_held_time_ = esp_timer_get_time();
+        return;
+    }
+    if (!uplink_held_frame_.empty()) {
+        // A frame held before the processor was last stopped belongs to another turn
+        if (uplink_held_timestamp_ + OPUS_FRAME_DURATION_MS == timestamp &&
+            esp_timer_get_time() - uplink_held_time_ < OPUS_FRAME_DURATION_MS * 2 * 1000) {
+            EncodeAudioFrame(std::move(uplink_held_frame_), uplink_held_timestamp_);
+        }
+        uplink_held_frame_.clear();
+    }
+#endif
+    EncodeAudioFrame(std::move(frame), timestamp);
+}
+
+void Application::EncodeAudioFrame(std::vector<int16_t>&& data, uint32_t timestamp) {
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (audio_send_queue_.size() >= GetMaxAudioPacketsInQueue()) {
+            ESP_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
+            uplink_frames_dropped_++;
+            return;
+        }
+        generation = uplink_generation_;
+    }
+    background_task_->Schedule([this, data = std::move(data), timestamp, generation]() mutable {
+        int64_t encode_start_time = esp_timer_get_time();
+        bool encoded = false;
+        opus_encoder_->Encode(std::move(data), [this, timestamp, generation, &encoded](std::vector<uint8_t>&& opus) {
+            encoded = true;
+            AudioStreamPacket packet;
+            // The encoder hands out plain vectors, the packet takes a pool buffer
+            packet.payload = AudioPayloadPool::GetInstance().Acquire();
+            packet.payload.assign(opus.begin(), opus.end());
+#if CONFIG_UPLINK_SILENCE_DTX || CONFIG_UPLINK_SILENCE_SUPPRESS
+            packet.timestamp = timestamp;
+#endif
+#ifdef CONFIG_USE_SERVER_AEC
+            {
+                std::lock_guard<std::mutex> lock(timestamp_mutex_);
+                if (!timestamp_queue_.empty()) {
+                    packet.timestamp = timestamp_queue_.front();
+                    timestamp_queue_.pop_front();
+                } else {
+                    packet.timestamp = 0;
+                }
+
+                if (timestamp_queue_.size() > 3) { // 限制队列长度3
+                    timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
+                    return;
+                }
+            }
+#endif
+#if CONFIG_UPLINK_SILENCE_DTX || CONFIG_UPLINK_SILENCE_SUPPRESS
+            // With DTX on, packets of two bytes or less carry no audio and need not be sent,
+            // the timestamps tell the server how long the gap is. Without timestamps every
+            // DTX frame is sent as it is
+            if (uplink_dtx_ && packet.payload.size() <= 2 && protocol_->CarriesAudioTimestamps()) {
+                uplink_frames_suppressed_++;
+                return;
+            }
+#endif
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (generation != uplink_generation_) {
+                return;
+            }
+            if (audio_send_queue_.size() >= GetMaxAudioPacketsInQueue()) {
+                ESP_LOGW(TAG, "Too many audio packets in queue, drop the oldest packet");
+                audio_send_queue_.pop_front();
+                uplink_frames_dropped_++;
+            }
+            audio_send_queue_.emplace_back(std::move(packet));
+            uplink_frames_sent_++;
+            xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
+        });
+        int64_t encode_time_us = esp_timer_get_time() - encode_start_time;
+        // A call that only buffered PCM says nothing about the encode time per packet
+        if (!encoded) {
+            return;
+        }
+        size_t send_queue_depth;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            send_queue_depth = audio_send_queue_.size();
+        }
+        // The queue only builds up by design while the channel opens, that says nothing about the link
+        if (device_state_ == kDeviceStateConnecting) {
+            return;
+        }
+        if (encoder_governor_.OnFrameEncoded(encode_time_us, send_queue_depth, MAX_AUDIO_PACKETS_IN_QUEUE)) {
+            opus_encoder_->SetComplexity(encoder_governor_.complexity());
+            uplink_dtx_ = UPLINK_DTX_ALWAYS || encoder_governor_.dtx();
+            opus_encoder_->SetDtx(uplink_dtx_);
+        }
+    }, kBackgroundTaskLaneEncode);
+}
+
 void Application::OnClockTimer() {
     clock_ticks_++;
 
@@ -751,6 +960,11 @@ void Application::OnClockTimer() {
         // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
         // SystemInfo::PrintTaskList();
         SystemInfo::PrintHeapStats();
+        AudioPayloadPool::GetInstance().PrintStats();
+        Board::GetInstance().GetAudioCodec()->PrintStats();
+        encoder_governor_.PrintStats();
+        ESP_LOGI(TAG, "Uplink frames: %lu sent, %lu suppressed", (unsigned long)uplink_frames_sent_.load(),
+            (unsigned long)uplink_frames_suppressed_.load());
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
@@ -767,15 +981,6 @@ void Application::OnClockTimer() {
     }
 }
 
-// Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
-    }
-    xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
-}
-
 // The Main Event Loop controls the chat state and websocket connection
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
@@ -790,89 +995,122 @@ void Application::MainEventLoop() {
             std::unique_lock<std::mutex> lock(mutex_);
             auto packets = std::move(audio_send_queue_);
             lock.unlock();
+            auto& payload_pool = AudioPayloadPool::GetInstance();
             for (auto& packet : packets) {
+                LatencyTracker::GetInstance().Mark(kLatencyStageFirstUplink);
                 if (!protocol_->SendAudio(packet)) {
                     break;
                 }
+                payload_pool.Release(std::move(packet.payload));
             }
         }
 
         if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
+            // main_tasks_ is lock-free, so producers never contend with the audio queues on mutex_
+            InlineTask task;
+            while (main_tasks_.Pop(task)) {
                 task();
+                task.Reset();
             }
         }
     }
 }
 
-// The Audio Loop is used to input and output audio data
+// The Audio Loop is used to input audio data
 void Application::AudioLoop() {
-    auto codec = Board::GetInstance().GetAudioCodec();
     while (true) {
         OnAudioInput();
-        if (codec->output_enabled()) {
-            OnAudioOutput();
-        }
     }
 }
 
-void Application::OnAudioOutput() {
-    if (busy_decoding_audio_) {
-        return;
-    }
-
-    auto now = std::chrono::steady_clock::now();
+// The Audio Output Loop decodes packets as soon as they are queued and writes them to the codec
+void Application::AudioOutputLoop() {
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
-        // Disable the output if there is no audio data for a long time
-        if (device_state_ == kDeviceStateIdle) {
-            auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
-            if (duration > max_silence_seconds) {
-                codec->EnableOutput(false);
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // While playing, the next frame is due one frame duration after the last one was written
+        auto timeout = std::chrono::milliseconds(1000);
+        if (audio_decode_queue_.playing() && audio_decode_queue_.frame_duration() > 0) {
+            timeout = std::chrono::milliseconds(audio_decode_queue_.frame_duration());
+        }
+        bool has_packet = audio_decode_cv_.wait_for(lock, timeout, [this, codec]() {
+            return !audio_decode_queue_.empty() && codec->output_enabled();
+        });
+        if (!has_packet) {
+            // The playout deadline passed without a packet, let the jitter buffer see the underrun
+            // so it rebuffers to its target depth before playing again
+            if (audio_decode_queue_.playing() && codec->output_enabled()) {
+                AudioStreamPacket packet;
+                audio_decode_queue_.Pop(packet, esp_timer_get_time() / 1000);
+            }
+            // Disable the output if there is no audio data for a long time
+            if (device_state_ == kDeviceStateIdle && codec->output_enabled() && audio_decode_queue_.empty()) {
+                auto duration = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - last_output_time_).count();
+                if (duration > max_silence_seconds) {
+                    codec->EnableOutput(false);
+                }
             }
+            continue;
         }
-        return;
+
+        AudioStreamPacket packet;
+        auto result = audio_decode_queue_.Pop(packet, esp_timer_get_time() / 1000);
+        if (result == kJitterBufferBuffering) {
+            // Wake up again on the next packet or when the buffering deadline may have passed
+            audio_decode_cv_.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        } else if (result == kJitterBufferEmpty) {
+            continue;
+        }
+        decoding_audio_ = true;
+        lock.unlock();
+
+        OnAudioOutput(std::move(packet));
+
+        lock.lock();
+        decoding_audio_ = false;
+        NotifyIfAudioDrained();
+        lock.unlock();
+        audio_decode_cv_.notify_all();
     }
+}
 
-    auto packet = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
-    audio_decode_cv_.notify_all();
+void Application::OnAudioOutput(AudioStreamPacket&& packet) {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    if (aborted_) {
+        return;
+    }
 
     // Synchronize the sample rate and frame duration
     SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
 
-    busy_decoding_audio_ = true;
-    background_task_->Schedule([this, codec, packet = std::move(packet)]() mutable {
-        busy_decoding_audio_ = false;
-        if (aborted_) {
-            return;
-        }
-
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
-            return;
-        }
-        // Resample if the sample rate is different
-        if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
-        }
-        codec->OutputData(pcm);
+    // A lost packet has an empty payload, which makes the Opus decoder run packet loss concealment
+    // The decoder takes a plain vector, the copy reuses decode_payload_'s capacity
+    decode_payload_.assign(packet.payload.begin(), packet.payload.end());
+    AudioPayloadPool::GetInstance().Release(std::move(packet.payload));
+    bool decoded = opus_decoder_->Decode(std::move(decode_payload_), decode_buffer_);
+    if (!decoded) {
+        return;
+    }
+    std::span<const int16_t> pcm(decode_buffer_);
+    // Resample if the sample rate is different
+    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
+        resample_buffer_.resize(output_resampler_.GetOutputSamples(decode_buffer_.size()));
+        output_resampler_.Process(decode_buffer_.data(), decode_buffer_.size(), resample_buffer_.data());
+        pcm = resample_buffer_;
+    }
+    // Only the reply ends a turn, not the popup or alert sounds played in between
+    if (!packet.local_sound) {
+        LatencyTracker::GetInstance().Mark(kLatencyStageFirstOutput);
+    }
+    codec->OutputData(pcm);
 #ifdef CONFIG_USE_SERVER_AEC
-        std::lock_guard<std::mutex> lock(timestamp_mutex_);
-        timestamp_queue_.push_back(packet.timestamp);
+    std::lock_guard<std::mutex> lock(timestamp_mutex_);
+    timestamp_queue_.push_back(packet.timestamp);
 #endif
-        last_output_time_ = std::chrono::steady_clock::now();
-    });
+    last_output_time_ = std::chrono::steady_clock::now();
 }
 
 void Application::OnAudioInput() {
@@ -888,41 +1126,43 @@ void Application::OnAudioInput() {
             background_task_->Schedule([this, data = std::move(data)]() mutable {
                 opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
                     AudioStreamPacket packet;
-                    packet.payload = std::move(opus);
+                    packet.payload = AudioPayloadPool::GetInstance().Acquire();
+                    packet.payload.assign(opus.begin(), opus.end());
                     packet.frame_duration = OPUS_FRAME_DURATION_MS;
                     packet.sample_rate = 16000;
+                    packet.local_sound = true;
                     std::lock_guard<std::mutex> lock(mutex_);
                     audio_testing_queue_.push_back(std::move(packet));
                 });
-            });
+            }, kBackgroundTaskLaneEncode);
             return;
         }
     }
 #endif
 
     if (wake_word_->IsDetectionRunning()) {
-        std::vector<int16_t> data;
         int samples = wake_word_->GetFeedSize();
         if (samples > 0) {
-            if (ReadAudio(data, 16000, samples)) {
-                wake_word_->Feed(data);
+            if (ReadAudio(input_data_, 16000, samples)) {
+                wake_word_->Feed(input_data_);
                 return;
             }
         }
     }
 
     if (audio_processor_->IsRunning()) {
-        std::vector<int16_t> data;
         int samples = audio_processor_->GetFeedSize();
         if (samples > 0) {
-            if (ReadAudio(data, 16000, samples)) {
-                audio_processor_->Feed(data);
+            if (ReadAudio(input_data_, 16000, samples)) {
+                audio_processor_->Feed(input_data_);
                 return;
             }
         }
     }
 
-    vTaskDelay(pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
+    // Nothing consumes microphone data, sleep until a state change starts a consumer.
+    // The timeout is only a safety net for consumers started outside Application.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
 }
 
 bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
@@ -932,30 +1172,26 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
     }
 
     if (codec->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec->input_sample_rate() / sample_rate);
-        if (!codec->InputData(data)) {
+        // All intermediate buffers are members that keep their capacity between frames,
+        // so steady-state capture does not touch the heap
+        input_buffer_.resize(samples * codec->input_sample_rate() / sample_rate);
+        if (!codec->InputData(input_buffer_)) {
             return false;
         }
         if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            size_t frames = input_buffer_.size() / 2;
+            mic_channel_.resize(frames);
+            reference_channel_.resize(frames);
+            DeinterleaveStereo(input_buffer_.data(), mic_channel_.data(), reference_channel_.data(), frames);
+            resampled_mic_.resize(input_resampler_.GetOutputSamples(frames));
+            resampled_reference_.resize(reference_resampler_.GetOutputSamples(frames));
+            input_resampler_.Process(mic_channel_.data(), frames, resampled_mic_.data());
+            reference_resampler_.Process(reference_channel_.data(), frames, resampled_reference_.data());
+            data.resize(resampled_mic_.size() * 2);
+            InterleaveStereo(resampled_mic_.data(), resampled_reference_.data(), data.data(), resampled_mic_.size());
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            data.resize(input_resampler_.GetOutputSamples(input_buffer_.size()));
+            input_resampler_.Process(input_buffer_.data(), input_buffer_.size(), data.data());
         }
     } else {
         data.resize(samples);
@@ -972,6 +1208,48 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
     return true;
 }
 
+void Application::StartUplinkCapture() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        audio_send_queue_.clear();
+        uplink_frames_dropped_ = 0;
+    }
+    background_task_->Schedule([this]() {
+        opus_encoder_->ResetState();
+    }, kBackgroundTaskLaneEncode);
+    audio_processor_->Start();
+    NotifyAudioInput();
+}
+
+void Application::StopUplinkCapture() {
+    audio_processor_->Stop();
+    DiscardUplink();
+}
+
+// The limit is higher while the channel opens, a slow connect would otherwise cut the request short
+size_t Application::GetMaxAudioPacketsInQueue() const {
+    if (device_state_ == kDeviceStateConnecting) {
+        return MAX_AUDIO_PACKETS_WHILE_CONNECTING;
+    }
+    return MAX_AUDIO_PACKETS_IN_QUEUE;
+}
+
+void Application::DiscardUplink() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uplink_generation_++;
+    audio_send_queue_.clear();
+}
+
+bool Application::OpenAudioChannel() {
+    auto& tracker = LatencyTracker::GetInstance();
+    tracker.Mark(kLatencyStageChannelOpenStart);
+    if (!protocol_->OpenAudioChannel()) {
+        return false;
+    }
+    tracker.Mark(kLatencyStageChannelOpenEnd);
+    return true;
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
@@ -991,9 +1269,14 @@ void Application::SetDeviceState(DeviceState state) {
     clock_ticks_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
+    // Deferred steps of the previous transition check this and give up once superseded
+    auto transition_id = ++transition_id_;
+    transition_start_time_ = esp_timer_get_time();
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
+    if (previous_state == kDeviceStateSpeaking) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        audio_decode_queue_.PrintStats();
+    }
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -1004,10 +1287,21 @@ void Application::SetDeviceState(DeviceState state) {
         case kDeviceStateIdle:
             display->SetStatus(Lang::Strings::STANDBY);
             display->SetEmotion("neutral");
+            // Before the standby sound, which would otherwise count as the reply
+            LatencyTracker::GetInstance().AbandonTurn();
             Alert(Lang::Strings::STANDBY, Lang::Strings::STANDBY, "happy", Lang::Sounds::P3_SUCCESS);
-            vTaskDelay(pdMS_TO_TICKS(1000));
             audio_processor_->Stop();
-            wake_word_->StartDetection();            
+            // Frames still being encoded or queued must not reach the server after listening ended
+            DiscardUplink();
+            // Start detection after the standby sound, so it can not trigger the wake word
+            RunWhenAudioDrained([this, transition_id]() {
+                if (transition_id != transition_id_) {
+                    return;
+                }
+                wake_word_->StartDetection();
+                NotifyAudioInput();
+                LogTransitionTime();
+            });
             break;
         case kDeviceStateConnecting:
             display->SetStatus(Lang::Strings::CONNECTING);
@@ -1018,6 +1312,8 @@ void Application::SetDeviceState(DeviceState state) {
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
+            // Follow-up turns on an open channel start here
+            LatencyTracker::GetInstance().MarkOrBeginTurn(kLatencyStageListening);
             // Update the IoT states before sending the start listening command
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
             UpdateIotStates();
@@ -1026,15 +1322,29 @@ void Application::SetDeviceState(DeviceState state) {
             if (!audio_processor_->IsRunning()) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
+                wake_word_->StopDetection();
+                // Queued behind any encode still in flight from the previous session
+                background_task_->Schedule([this]() {
+                    opus_encoder_->ResetState();
+                }, kBackgroundTaskLaneEncode);
                 if (previous_state == kDeviceStateSpeaking) {
-                    audio_decode_queue_.clear();
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    audio_decode_queue_.Clear();
                     audio_decode_cv_.notify_all();
-                    // FIXME: Wait for the speaker to empty the buffer
-                    vTaskDelay(pdMS_TO_TICKS(120));
                 }
-                opus_encoder_->ResetState();
-                audio_processor_->Start();
-                wake_word_->StopDetection();
+                // Start capturing once the speaker has finished the packet being played
+                RunWhenAudioDrained([this, transition_id]() {
+                    if (transition_id != transition_id_ || audio_processor_->IsRunning()) {
+                        return;
+                    }
+                    audio_processor_->Start();
+                    NotifyAudioInput();
+                    LogTransitionTime();
+                });
+            } else if (previous_state == kDeviceStateConnecting) {
+                // Capture started at the wake word, the frames buffered since then are sent after this
+                protocol_->SendStartListening(listening_mode_);
+                LogTransitionTime();
             }
             break;
         case kDeviceStateSpeaking:
@@ -1042,6 +1352,7 @@ void Application::SetDeviceState(DeviceState state) {
 
             if (listening_mode_ != kListeningModeRealtime) {
                 audio_processor_->Stop();
+                DiscardUplink();
                 // Only AFE wake word can be detected in speaking mode
 #if CONFIG_USE_AFE_WAKE_WORD
                 wake_word_->StartDetection();
@@ -1055,25 +1366,85 @@ void Application::SetDeviceState(DeviceState state) {
             // Do nothing
             break;
     }
+
+    // The set of audio input consumers may have changed
+    NotifyAudioInput();
+}
+
+void Application::RunWhenAudioDrained(InlineTask&& callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    audio_drained_tasks_.emplace_back(std::move(callback));
+    NotifyIfAudioDrained();
+}
+
+void Application::NotifyIfAudioDrained() {
+    // Called with mutex_ held
+    if (audio_drained_tasks_.empty() || !audio_decode_queue_.empty() || decoding_audio_) {
+        return;
+    }
+    for (auto& task : audio_drained_tasks_) {
+        Schedule(std::move(task));
+    }
+    audio_drained_tasks_.clear();
+}
+
+void Application::LogTransitionTime() {
+    ESP_LOGI(TAG, "STATE: %s settled in %lld ms", STATE_STRINGS[device_state_],
+        (esp_timer_get_time() - transition_start_time_) / 1000);
+}
+
+void Application::NotifyAudioInput() {
+    if (audio_loop_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_loop_task_handle_);
+    }
 }
 
 void Application::ResetDecoder() {
     std::lock_guard<std::mutex> lock(mutex_);
     opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
-    audio_decode_cv_.notify_all();
+    audio_decode_queue_.Clear();
+    NotifyIfAudioDrained();
+    EnableAudioOutput();
+}
+
+void Application::EnableAudioOutput() {
+    // Called with mutex_ held
     last_output_time_ = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     codec->EnableOutput(true);
+    // The output task waits for the output to be enabled, so wake it up only after enabling it
+    audio_decode_cv_.notify_all();
 }
 
 void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
+    // Only the output task switches decoders, so it can check the current one without the lock
     if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
         return;
     }
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    // ResetDecoder uses opus_decoder_ from the main task, hold the lock while it is swapped
+    // and while evicted decoders are freed
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Sounds and tts often use different formats, so keep the decoders of recent formats
+    // around instead of churning ~25 KB of heap on every switch. Most recently used is last.
+    auto it = std::find_if(opus_decoders_.begin(), opus_decoders_.end(), [sample_rate, frame_duration](const auto& decoder) {
+        return decoder->sample_rate() == sample_rate && decoder->duration_ms() == frame_duration;
+    });
+    std::unique_ptr<OpusDecoderWrapper> decoder;
+    if (it != opus_decoders_.end()) {
+        decoder = std::move(*it);
+        opus_decoders_.erase(it);
+        decoder->ResetState();
+    } else {
+        if (opus_decoders_.size() >= MAX_OPUS_DECODERS) {
+            opus_decoders_.erase(opus_decoders_.begin());
+        }
+        ESP_LOGI(TAG, "Creating opus decoder for %d Hz %d ms", sample_rate, frame_duration);
+        decoder = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    }
+    opus_decoder_ = decoder.get();
+    opus_decoders_.push_back(std::move(decoder));
 
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
@@ -1167,13 +1538,14 @@ void Application::SetAecMode(AecMode mode) {
     });
 }
 
-void Application::WaitForAudioPlayback() {
-    // Wait for audio decode queue to be empty
+void Application::WaitForAudioDecode() {
+    // Wait for the decode queue to be empty and the last packet to be written to the codec
     std::unique_lock<std::mutex> lock(mutex_);
     audio_decode_cv_.wait(lock, [this]() {
-        return audio_decode_queue_.empty();
+        return audio_decode_queue_.empty() && !decoding_audio_;
     });
-    lock.unlock();
-    // Wait for background tasks to complete
-    background_task_->WaitForCompletion();
+}
+
+void Application::WaitForAudioPlayback() {
+    WaitForAudioDecode();
 }
@@ -12,10 +12,10 @@
 #include <vector>
 #include <condition_variable>
 #include <memory>
+#include <atomic>
 
 #include <opus_encoder.h>
 #include <opus_decoder.h>
-#include <opus_resampler.h>
 
 #include "protocol.h"
 #include "ota.h"
@@ -23,6 +23,13 @@
 #include "audio_processor.h"
 #include "wake_word.h"
 #include "audio_debugger.h"
+#include "task_queue.h"
+#include "jitter_buffer.h"
+#include "polyphase_resampler.h"
+#include "encoder_governor.h"
+#if CONFIG_USE_WAKE_WORD_PROFILER
+#include "wake_word_profiler.h"
+#endif
 
 #define SCHEDULE_EVENT (1 << 0)
 #define SEND_AUDIO_EVENT (1 << 1)
@@ -49,7 +56,28 @@ enum DeviceState {
 };
 
 #define OPUS_FRAME_DURATION_MS 60
+// The uplink is encoded as 16 kHz mono
+#define UPLINK_FRAME_SAMPLES (16000 * OPUS_FRAME_DURATION_MS / 1000)
+#define MAX_MAIN_TASKS_IN_QUEUE 64
 #define MAX_AUDIO_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// The uplink captured after the wake word waits in the send queue until the channel opens
+#define MAX_AUDIO_PACKETS_WHILE_CONNECTING (8000 / OPUS_FRAME_DURATION_MS)
+// Upper bound for the adaptive encoder complexity, the S3 and P4 have the headroom for better quality
+#if CONFIG_IDF_TARGET_ESP32S3 || CONFIG_IDF_TARGET_ESP32P4
+#define MAX_OPUS_COMPLEXITY 8
+#else
+#define MAX_OPUS_COMPLEXITY 3
+#endif
+#define MAX_OPUS_COMPLEXITY_WITH_AEC 2
+
+#if CONFIG_UPLINK_SILENCE_DTX
+#define UPLINK_DTX_ALWAYS true
+#else
+#define UPLINK_DTX_ALWAYS false
+#endif
+// Frames still sent after the VAD reports silence, so word endings are not clipped
+#define UPLINK_SILENCE_HANGOVER_MS 300
+#define MAX_OPUS_DECODERS 3
 #ifdef CONFIG_ENABLE_AUDIO_TESTING_IN_WIFI_CONFIG
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #endif
@@ -67,7 +95,11 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    template<typename F>
+    void Schedule(F&& callback) {
+        main_tasks_.Push(InlineTask(std::forward<F>(callback)));
+        xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
+    }
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -85,17 +117,23 @@ public:
     AecMode GetAecMode() const { return aec_mode_; }
     BackgroundTask* GetBackgroundTask() const { return background_task_; }
     void WaitForAudioPlayback();
+#if CONFIG_USE_WAKE_WORD_PROFILER
+    WakeWordProfiler* GetWakeWordProfiler() const { return wake_word_profiler_; }
+#endif
 
 private:
     Application();
     ~Application();
 
     std::unique_ptr<WakeWord> wake_word_;
+#if CONFIG_USE_WAKE_WORD_PROFILER
+    WakeWordProfiler* wake_word_profiler_ = nullptr;
+#endif
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
     Ota ota_;
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    TaskQueue<MAX_MAIN_TASKS_IN_QUEUE> main_tasks_;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
@@ -105,16 +143,25 @@ private:
 
     bool aborted_ = false;
     bool voice_detected_ = false;
-    bool busy_decoding_audio_ = false;
+    bool decoding_audio_ = false;
+    // Bumped when the uplink is dropped, encodes still in flight from before are discarded
+    uint32_t uplink_generation_ = 0;
+    // Uplink frames lost to a full send queue since the capture started
+    uint32_t uplink_frames_dropped_ = 0;
+    // Run on the main loop once the decode queue is empty and the output task is idle
+    std::list<InlineTask> audio_drained_tasks_;
+    uint32_t transition_id_ = 0;
+    int64_t transition_start_time_ = 0;
     int clock_ticks_ = 0;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     // Audio encode / decode
     TaskHandle_t audio_loop_task_handle_ = nullptr;
+    TaskHandle_t audio_output_task_handle_ = nullptr;
     BackgroundTask* background_task_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
     std::list<AudioStreamPacket> audio_send_queue_;
-    std::list<AudioStreamPacket> audio_decode_queue_;
+    JitterBuffer audio_decode_queue_;
     std::condition_variable audio_decode_cv_;
 #ifdef CONFIG_ENABLE_AUDIO_TESTING_IN_WIFI_CONFIG
     std::list<AudioStreamPacket> audio_testing_queue_;
@@ -125,23 +172,65 @@ private:
     std::mutex timestamp_mutex_;
 
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
-
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    EncoderGovernor encoder_governor_;
+    bool uplink_dtx_ = false;
+    std::atomic<bool> uplink_speaking_ = false;
+    // Processor output collected into whole encoder frames, only used by the processor output callback
+    std::vector<int16_t> uplink_frame_;
+    int64_t uplink_frame_time_ = 0;
+    uint32_t uplink_timestamp_ = 0;
+    int uplink_hangover_frames_ = 0;
+    std::vector<int16_t> uplink_held_frame_;
+    uint32_t uplink_held_timestamp_ = 0;
+    int64_t uplink_held_time_ = 0;
+    std::atomic<uint32_t> uplink_frames_sent_ = 0;
+    std::atomic<uint32_t> uplink_frames_suppressed_ = 0;
+    // Decoders of recently used formats, opus_decoder_ points to the current one
+    std::vector<std::unique_ptr<OpusDecoderWrapper>> opus_decoders_;
+    OpusDecoderWrapper* opus_decoder_ = nullptr;
+
+    PolyphaseResampler input_resampler_;
+    PolyphaseResampler reference_resampler_;
+    PolyphaseResampler output_resampler_;
+
+    // Playback buffers, only touched by the audio output task
+    std::vector<int16_t> decode_buffer_;
+    std::vector<uint8_t> decode_payload_;
+    std::vector<int16_t> resample_buffer_;
+    // Capture scratch buffers, only touched by the audio loop task
+    std::vector<int16_t> input_data_;
+    std::vector<int16_t> input_buffer_;
+    std::vector<int16_t> mic_channel_;
+    std::vector<int16_t> reference_channel_;
+    std::vector<int16_t> resampled_mic_;
+    std::vector<int16_t> resampled_reference_;
 
     void MainEventLoop();
     void OnAudioInput();
-    void OnAudioOutput();
+    void OnAudioOutput(AudioStreamPacket&& packet);
+    void WaitForAudioDecode();
+    void RunWhenAudioDrained(InlineTask&& callback);
+    void NotifyIfAudioDrained();
+    void LogTransitionTime();
     bool ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
+    bool OpenAudioChannel();
+    void StartUplinkCapture();
+    void StopUplinkCapture();
+    void DiscardUplink();
+    size_t GetMaxAudioPacketsInQueue() const;
+    void EnableAudioOutput();
     void ResetDecoder();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
     void CheckNewVersion();
     void ShowActivationCode();
+    void OnUplinkOutput(std::vector<int16_t>&& data);
+    void OnUplinkFrame(std::vector<int16_t>&& frame);
+    void EncodeAudioFrame(std::vector<int16_t>&& data, uint32_t timestamp);
     void OnClockTimer();
     void SetListeningMode(ListeningMode mode);
     void AudioLoop();
+    void AudioOutputLoop();
+    void NotifyAudioInput();
 #ifdef CONFIG_ENABLE_AUDIO_TESTING_IN_WIFI_CONFIG
     void EnterAudioTestingMode();
     void ExitAudioTestingMode();
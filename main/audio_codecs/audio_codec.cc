@@ -3,22 +3,62 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_system.h>
+#include <esp_attr.h>
 #include <cstring>
 #include <driver/i2s_common.h>
 
 #define TAG "AudioCodec"
 
 AudioCodec::AudioCodec() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto self = static_cast<AudioCodec*>(arg);
+            // The esp_timer task has a small stack for an NVS write, so the owner decides
+            // where to save. Without a handler the volume is saved by SaveOutputVolume()
+            if (self->output_volume_settled_) {
+                self->output_volume_settled_();
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "volume_save_timer",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &volume_save_timer_));
+
+    // A pending volume change must not be lost on reboot. Registered here rather than in
+    // Start(), so boards that override Start() are covered too
+    static bool shutdown_handler_registered = false;
+    if (!shutdown_handler_registered) {
+        esp_register_shutdown_handler([]() {
+            Board::GetInstance().GetAudioCodec()->SaveOutputVolume();
+        });
+        shutdown_handler_registered = true;
+    }
 }
 
 AudioCodec::~AudioCodec() {
+    if (volume_save_timer_ != nullptr) {
+        esp_timer_stop(volume_save_timer_);
+        esp_timer_delete(volume_save_timer_);
+    }
 }
 
-void AudioCodec::OutputData(std::vector<int16_t>& data) {
+void AudioCodec::OutputData(std::span<const int16_t> data) {
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    if (output_dry_.exchange(false) && now_ms - output_dry_at_ms_.load() < AUDIO_CODEC_UNDERRUN_GAP_MS) {
+        output_underruns_++;
+    }
     Write(data.data(), data.size());
+    // Armed once the data is queued, so a dry spell before this write is not taken for a new one
+    output_armed_ = true;
+    if (output_sample_rate_ > 0) {
+        output_played_ms_ += data.size() * 1000 / (output_sample_rate_ * output_channels_);
+    }
 }
 
-bool AudioCodec::InputData(std::vector<int16_t>& data) {
+bool AudioCodec::InputData(std::span<int16_t> data) {
     int samples = Read(data.data(), data.size());
     if (samples > 0) {
         return true;
@@ -29,11 +69,13 @@ bool AudioCodec::InputData(std::vector<int16_t>& data) {
 void AudioCodec::Start() {
     Settings settings("audio", false);
     output_volume_ = settings.GetInt("output_volume", output_volume_);
+    saved_output_volume_ = output_volume_;
     if (output_volume_ <= 0) {
         ESP_LOGW(TAG, "Output volume value (%d) is too small, setting to default (10)", output_volume_);
         output_volume_ = 10;
     }
 
+    RegisterI2sCallbacks();
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
 
@@ -42,12 +84,70 @@ void AudioCodec::Start() {
     ESP_LOGI(TAG, "Audio codec started");
 }
 
+// Fires for every DMA buffer the TX channel sends without new data, also while nothing is played
+bool IRAM_ATTR AudioCodec::OnI2sSendQueueOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto self = static_cast<AudioCodec*>(user_ctx);
+    if (self->output_armed_.exchange(false, std::memory_order_relaxed)) {
+        self->output_dry_at_ms_.store(esp_timer_get_time() / 1000, std::memory_order_relaxed);
+        self->output_dry_.store(true, std::memory_order_release);
+    }
+    return false;
+}
+
+// The user context is the counter to bump
+static bool IRAM_ATTR OnI2sQueueOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    static_cast<std::atomic<uint32_t>*>(user_ctx)->fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void AudioCodec::RegisterI2sCallbacks() {
+    if (tx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_send_q_ovf = OnI2sSendQueueOverflow;
+        if (i2s_channel_register_event_callback(tx_handle_, &callbacks, this) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to register TX event callbacks");
+        }
+    }
+    if (rx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_recv_q_ovf = OnI2sQueueOverflow;
+        if (i2s_channel_register_event_callback(rx_handle_, &callbacks, &input_overruns_) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to register RX event callbacks");
+        }
+    }
+}
+
+void AudioCodec::PrintStats() {
+    uint32_t underruns = output_underruns_.load();
+    uint32_t played_ms = output_played_ms_.load();
+    ESP_LOGI(TAG, "DMA %dx%d frames, output underruns: %lu (%.3f per second over %lu s played) input overruns: %lu",
+        AUDIO_CODEC_DMA_DESC_NUM, AUDIO_CODEC_DMA_FRAME_NUM, (unsigned long)underruns,
+        played_ms > 0 ? underruns * 1000.0f / played_ms : 0.0f, (unsigned long)(played_ms / 1000), input_overruns_.load());
+}
+
 void AudioCodec::SetOutputVolume(int volume) {
     output_volume_ = volume;
     ESP_LOGI(TAG, "Set output volume to %d", output_volume_);
-    
+
+    // The hardware follows immediately, the flash write waits for the knob to settle
+    if (esp_timer_is_active(volume_save_timer_)) {
+        esp_timer_stop(volume_save_timer_);
+        volume_writes_avoided_++;
+    }
+    esp_timer_start_once(volume_save_timer_, AUDIO_CODEC_VOLUME_SAVE_DELAY_MS * 1000);
+}
+
+void AudioCodec::SaveOutputVolume() {
+    esp_timer_stop(volume_save_timer_);
+    std::lock_guard<std::mutex> lock(volume_save_mutex_);
+    int volume = output_volume_;
+    if (volume == saved_output_volume_) {
+        return;
+    }
     Settings settings("audio", true);
-    settings.SetInt("output_volume", output_volume_);
+    settings.SetInt("output_volume", volume);
+    saved_output_volume_ = volume;
+    ESP_LOGI(TAG, "Saved output volume %d, %lu flash writes avoided", volume, volume_writes_avoided_);
 }
 
 void AudioCodec::EnableInput(bool enable) {
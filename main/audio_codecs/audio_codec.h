@@ -4,16 +4,26 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <driver/i2s_std.h>
+#include <esp_timer.h>
 
 #include <vector>
+#include <span>
 #include <string>
 #include <functional>
+#include <mutex>
+#include <atomic>
 
 #include "board.h"
 
-#define AUDIO_CODEC_DMA_DESC_NUM 6
-#define AUDIO_CODEC_DMA_FRAME_NUM 240
+// Boards tune these through sdkconfig_append in their config.json
+#define AUDIO_CODEC_DMA_DESC_NUM CONFIG_AUDIO_CODEC_DMA_DESC_NUM
+#define AUDIO_CODEC_DMA_FRAME_NUM CONFIG_AUDIO_CODEC_DMA_FRAME_NUM
 #define AUDIO_CODEC_DEFAULT_MIC_GAIN 30.0
+// The volume is written to NVS once it has not changed for this long
+#define AUDIO_CODEC_VOLUME_SAVE_DELAY_MS 2000
+// The TX DMA runs dry at the end of every playback too, running dry only counts as an
+// underrun when playback resumes within this time
+#define AUDIO_CODEC_UNDERRUN_GAP_MS 200
 
 class AudioCodec {
 public:
@@ -21,11 +31,22 @@ public:
     virtual ~AudioCodec();
     
     virtual void SetOutputVolume(int volume);
+    // Writes a pending volume change to NVS now, call before sleep
+    void SaveOutputVolume();
+    // Called on the esp_timer task once the volume has not changed for AUDIO_CODEC_VOLUME_SAVE_DELAY_MS,
+    // the handler is expected to call SaveOutputVolume() from a task with enough stack
+    void OnOutputVolumeSettled(std::function<void()> callback) { output_volume_settled_ = callback; }
+    void PrintStats();
     virtual void EnableInput(bool enable);
     virtual void EnableOutput(bool enable);
 
-    virtual void OutputData(std::vector<int16_t>& data);
-    virtual bool InputData(std::vector<int16_t>& data);
+    // The caller's buffer goes to Write()/Read() as is, codecs decide whether they copy it.
+    // NoAudioCodec fills the DMA buffers from it in the TX ISR with CONFIG_AUDIO_CODEC_TX_ISR_FILL
+    virtual void OutputData(std::span<const int16_t> data);
+    virtual bool InputData(std::span<int16_t> data);
+    // Vector shims for existing callers
+    void OutputData(std::vector<int16_t>& data) { OutputData(std::span<const int16_t>(data)); }
+    bool InputData(std::vector<int16_t>& data) { return InputData(std::span<int16_t>(data)); }
     virtual void Start();
 
     inline bool duplex() const { return duplex_; }
@@ -37,6 +58,9 @@ public:
     inline int output_volume() const { return output_volume_; }
     inline bool input_enabled() const { return input_enabled_; }
     inline bool output_enabled() const { return output_enabled_; }
+    inline uint32_t output_underruns() const { return output_underruns_.load(); }
+    inline uint32_t output_played_ms() const { return output_played_ms_.load(); }
+    inline uint32_t input_overruns() const { return input_overruns_.load(); }
 
 protected:
     i2s_chan_handle_t tx_handle_ = nullptr;
@@ -52,8 +76,29 @@ protected:
     int output_channels_ = 1;
     int output_volume_ = 70;
 
+    esp_timer_handle_t volume_save_timer_ = nullptr;
+    std::function<void()> output_volume_settled_;
+    std::mutex volume_save_mutex_;
+    int saved_output_volume_ = -1;
+    uint32_t volume_writes_avoided_ = 0;
+
+    // The TX DMA ran dry during playback, or RX data was dropped in the I2S ISR
+    std::atomic<uint32_t> output_underruns_{0};
+    std::atomic<uint32_t> input_overruns_{0};
+    // Set after each write, the TX ISR clears it and notes the time when the DMA runs dry
+    std::atomic<bool> output_armed_{false};
+    std::atomic<bool> output_dry_{false};
+    std::atomic<uint32_t> output_dry_at_ms_{0};
+    std::atomic<uint32_t> output_played_ms_{0};
+
+    // Must be called before the channels are enabled
+    virtual void RegisterI2sCallbacks();
+
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+
+private:
+    static bool OnI2sSendQueueOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
 };
 
 #endif // _AUDIO_CODEC_H
@@ -1,11 +1,22 @@
 #include "no_audio_codec.h"
 
 #include <esp_log.h>
+#include <esp_attr.h>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
+
+#include "audio_kernels.h"
 
 #define TAG "NoAudioCodec"
 
+#if CONFIG_AUDIO_CODEC_TX_ISR_FILL
+// The TX ISR fills every DMA buffer itself, clearing it after the callback would drop the samples
+#define NO_AUDIO_CODEC_TX_AUTO_CLEAR false
+#else
+#define NO_AUDIO_CODEC_TX_AUTO_CLEAR true
+#endif
+
 NoAudioCodec::~NoAudioCodec() {
     if (rx_handle_ != nullptr) {
         i2s_channel_disable(rx_handle_);
@@ -25,7 +36,7 @@ NoAudioCodecDuplex::NoAudioCodecDuplex(int input_sample_rate, int output_sample_
         .role = I2S_ROLE_MASTER,
         .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
         .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
-        .auto_clear_after_cb = true,
+        .auto_clear_after_cb = NO_AUDIO_CODEC_TX_AUTO_CLEAR,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
     };
@@ -84,7 +95,7 @@ ATK_NoAudioCodecDuplex::ATK_NoAudioCodecDuplex(int input_sample_rate, int output
         .role = I2S_ROLE_MASTER,
         .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
         .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
-        .auto_clear_after_cb = true,
+        .auto_clear_after_cb = NO_AUDIO_CODEC_TX_AUTO_CLEAR,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
     };
@@ -143,7 +154,7 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
         .role = I2S_ROLE_MASTER,
         .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
         .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
-        .auto_clear_after_cb = true,
+        .auto_clear_after_cb = NO_AUDIO_CODEC_TX_AUTO_CLEAR,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
     };
@@ -212,7 +223,7 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
         .role = I2S_ROLE_MASTER,
         .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
         .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
-        .auto_clear_after_cb = true,
+        .auto_clear_after_cb = NO_AUDIO_CODEC_TX_AUTO_CLEAR,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
     };
@@ -280,7 +291,7 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
     i2s_chan_config_t tx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG((i2s_port_t)1, I2S_ROLE_MASTER);
     tx_chan_cfg.dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM;
     tx_chan_cfg.dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM;
-    tx_chan_cfg.auto_clear_after_cb = true;
+    tx_chan_cfg.auto_clear_after_cb = NO_AUDIO_CODEC_TX_AUTO_CLEAR;
     tx_chan_cfg.auto_clear_before_cb = false;
     tx_chan_cfg.intr_priority = 0;
     ESP_ERROR_CHECK(i2s_new_channel(&tx_chan_cfg, &tx_handle_, NULL));
@@ -335,60 +346,136 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
     ESP_LOGI(TAG, "Simplex channels created");
 }
 
-int NoAudioCodec::Write(const int16_t* data, int samples) {
-    std::vector<int32_t> buffer(samples);
-
+void NoAudioCodec::UpdateVolumeFactor() {
     // output_volume_: 0-100
     // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+    int volume = std::clamp(output_volume_, 0, 100);
+    volume_factor_ = pow(double(volume) / 100.0, 2) * 65536;
+    volume_factor_volume_ = output_volume_;
+}
+
+int NoAudioCodec::Write(const int16_t* data, int samples) {
+    // The volume is also restored from settings in Start(), so refresh lazily on change
+    if (volume_factor_volume_ != output_volume_) {
+        UpdateVolumeFactor();
     }
 
+#if CONFIG_AUDIO_CODEC_TX_ISR_FILL
+    if (samples <= 0) {
+        return 0;
+    }
+    // The TX ISR scales the samples straight into each DMA buffer it gets back, the caller's
+    // buffer must stay untouched until the ISR has taken all of it
+    portENTER_CRITICAL(&tx_lock_);
+    tx_data_ = data;
+    tx_remaining_ = samples;
+    portEXIT_CRITICAL(&tx_lock_);
+    xSemaphoreTake(tx_taken_, portMAX_DELAY);
+    return samples;
+#else
+    write_buffer_.resize(samples);
+    ScaleToInt32(data, write_buffer_.data(), samples, volume_factor_);
+
     size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, write_buffer_.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
     return bytes_written / sizeof(int32_t);
+#endif
 }
 
+void NoAudioCodec::RegisterI2sCallbacks() {
+    AudioCodec::RegisterI2sCallbacks();
+#if CONFIG_AUDIO_CODEC_TX_ISR_FILL
+    if (tx_handle_ == nullptr) {
+        return;
+    }
+    tx_taken_ = xSemaphoreCreateBinaryStatic(&tx_taken_buffer_);
+    // Replaces the queue overflow callback, without i2s_channel_write() the driver queue always
+    // overflows, so OnTxSent() notes the dry DMA itself
+    i2s_event_callbacks_t callbacks = {};
+    callbacks.on_sent = OnTxSent;
+    if (i2s_channel_register_event_callback(tx_handle_, &callbacks, this) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register TX fill callback");
+    }
+#endif
+}
+
+#if CONFIG_AUDIO_CODEC_TX_ISR_FILL
+// The buffer just sent goes out again after the other descriptors, the same order
+// i2s_channel_write() fills them in
+bool IRAM_ATTR NoAudioCodec::OnTxSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto self = static_cast<NoAudioCodec*>(user_ctx);
+    auto dest = static_cast<int32_t*>(event->dma_buf);
+    const size_t size = event->size / sizeof(int32_t);
+    const size_t carry_capacity = sizeof(self->tx_carry_) / sizeof(self->tx_carry_[0]);
+    BaseType_t need_yield = pdFALSE;
+
+    portENTER_CRITICAL_ISR(&self->tx_lock_);
+    const int32_t factor = self->volume_factor_;
+    size_t filled = std::min(self->tx_carry_samples_, size);
+    for (size_t i = 0; i < filled; i++) {
+        dest[i] = self->tx_carry_[i] * factor;
+    }
+    self->tx_carry_samples_ -= filled;
+    if (self->tx_carry_samples_ > 0) {
+        memmove(self->tx_carry_, self->tx_carry_ + filled, self->tx_carry_samples_ * sizeof(int16_t));
+    }
+
+    if (self->tx_data_ != nullptr) {
+        size_t take = std::min(self->tx_remaining_, size - filled);
+        for (size_t i = 0; i < take; i++) {
+            dest[filled + i] = self->tx_data_[i] * factor;
+        }
+        filled += take;
+        self->tx_data_ += take;
+        self->tx_remaining_ -= take;
+        // Less than a buffer left, keep the tail for the next write and release the writer
+        if (self->tx_remaining_ < size) {
+            size_t keep = std::min(self->tx_remaining_, carry_capacity - self->tx_carry_samples_);
+            memcpy(self->tx_carry_ + self->tx_carry_samples_, self->tx_data_, keep * sizeof(int16_t));
+            self->tx_carry_samples_ += keep;
+            self->tx_data_ = nullptr;
+            self->tx_remaining_ = 0;
+            xSemaphoreGiveFromISR(self->tx_taken_, &need_yield);
+        }
+    }
+    portEXIT_CRITICAL_ISR(&self->tx_lock_);
+
+    if (filled < size) {
+        memset(dest + filled, 0, (size - filled) * sizeof(int32_t));
+        if (self->output_armed_.exchange(false, std::memory_order_relaxed)) {
+            self->output_dry_at_ms_.store(esp_timer_get_time() / 1000, std::memory_order_relaxed);
+            self->output_dry_.store(true, std::memory_order_release);
+        }
+    }
+    return need_yield == pdTRUE;
+}
+#endif
+
 int NoAudioCodec::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    // The microphone delivers 32-bit slots, which do not fit in the caller's 16-bit
+    // buffer, so they land in a scratch buffer that keeps its capacity between reads
+    read_buffer_.resize(samples);
+    if (i2s_channel_read(rx_handle_, read_buffer_.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     samples = bytes_read / sizeof(int32_t);
-    for (int i = 0; i < samples; i++) {
-        int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
-    }
+    ShiftToInt16(read_buffer_.data(), dest, samples, 12);
     return samples;
 }
 
 int NoAudioCodecSimplexPdm::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    // PDM 解调后的数据位宽为 16 位
-    std::vector<int16_t> bit16_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit16_buffer.data(), samples * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    // PDM 解调后的数据位宽为 16 位，直接读入目标缓冲区
+    if (i2s_channel_read(rx_handle_, dest, samples * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     // 计算实际读取的样本数
-    samples = bytes_read / sizeof(int16_t);
-
-    // 将 16 位数据直接复制到目标缓冲区
-    memcpy(dest, bit16_buffer.data(), samples * sizeof(int16_t));
-
-    return samples;
+    return bytes_read / sizeof(int16_t);
 }
@@ -5,12 +5,36 @@
 
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
+#include <freertos/semphr.h>
 
 class NoAudioCodec : public AudioCodec {
 private:
+    // Q16 gain for output_volume_, recomputed only when the volume changes
+    int32_t volume_factor_ = 0;
+    int volume_factor_volume_ = -1;
+    std::vector<int32_t> write_buffer_;
+    std::vector<int32_t> read_buffer_;
+#if CONFIG_AUDIO_CODEC_TX_ISR_FILL
+    // Handed from Write() to the TX ISR, which scales the samples straight into the DMA buffers
+    portMUX_TYPE tx_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    StaticSemaphore_t tx_taken_buffer_;
+    SemaphoreHandle_t tx_taken_ = nullptr;
+    const int16_t* tx_data_ = nullptr;
+    size_t tx_remaining_ = 0;
+    // Tail of the last write that did not fill a whole DMA buffer
+    int16_t tx_carry_[AUDIO_CODEC_DMA_FRAME_NUM * 2];
+    size_t tx_carry_samples_ = 0;
+
+    static bool OnTxSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+#endif
+
+    void UpdateVolumeFactor();
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
 
+protected:
+    virtual void RegisterI2sCallbacks() override;
+
 public:
     virtual ~NoAudioCodec();
 };
@@ -12,6 +12,7 @@
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "afe_host.h"
 
 class AfeAudioProcessor : public AudioProcessor {
 public:
@@ -29,15 +30,13 @@ public:
     void EnableDeviceAec(bool enable) override;
 
 private:
-    EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AfeHost* afe_host_ = nullptr;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
     bool is_speaking_ = false;
 
-    void AudioProcessorTask();
+    void OnAfeResult(const afe_fetch_result_t* res);
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include "afe_host.h"
+
+#include <esp_log.h>
+#include <model_path.h>
+#include <string>
+
+#define TAG "AfeHost"
+
+#define CONSUMER_BIT(consumer) (1 << (consumer))
+
+AfeHost::AfeHost() {
+    event_group_ = xEventGroupCreate();
+}
+
+AfeHost::~AfeHost() {
+    for (auto& pipeline : pipeline_storage_) {
+        if (pipeline != nullptr && pipeline->data != nullptr) {
+            pipeline->iface->destroy(pipeline->data);
+        }
+    }
+    vEventGroupDelete(event_group_);
+}
+
+const char* AfeHost::GetTaskName(AfeConsumer consumer) {
+#if CONFIG_USE_AFE_SHARED_PIPELINE
+    return "audio_afe";
+#else
+    return consumer == kAfeConsumerWakeWord ? "audio_detection" : "audio_communication";
+#endif
+}
+
+bool AfeHost::Initialize(AfeConsumer consumer, AudioCodec* codec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pipelines_[consumer] != nullptr) {
+        return true;
+    }
+    codec_ = codec;
+    has_reference_ = codec_->input_reference();
+
+#if CONFIG_USE_AFE_SHARED_PIPELINE
+    for (auto& pipeline : pipeline_storage_) {
+        if (pipeline == nullptr) {
+            continue;
+        }
+        if (consumer == kAfeConsumerWakeWord && !pipeline->has_wakenet) {
+            ESP_LOGE(TAG, "The shared AFE pipeline was created without wakenet");
+            return false;
+        }
+        pipeline->consumer_bits |= CONSUMER_BIT(consumer);
+        pipelines_[consumer] = pipeline.get();
+        ConfigureStages(pipeline.get());
+        return true;
+    }
+#endif
+    return CreatePipeline(consumer);
+}
+
+// Must be called with mutex_ held
+bool AfeHost::CreatePipeline(AfeConsumer consumer) {
+    int ref_num = has_reference_ ? 1 : 0;
+    std::string input_format;
+    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+
+#if CONFIG_USE_AFE_SHARED_PIPELINE
+    EventBits_t consumer_bits = 0;
+#if CONFIG_USE_AFE_WAKE_WORD
+    consumer_bits |= CONSUMER_BIT(kAfeConsumerWakeWord);
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR
+    consumer_bits |= CONSUMER_BIT(kAfeConsumerProcessor);
+#endif
+    // Only the wake word brings wakenet, without it the shared pipeline serves the processor alone
+    if (consumer != kAfeConsumerWakeWord) {
+        consumer_bits = CONSUMER_BIT(consumer);
+    }
+#else
+    EventBits_t consumer_bits = CONSUMER_BIT(consumer);
+#endif
+    bool for_wake_word = consumer_bits & CONSUMER_BIT(kAfeConsumerWakeWord);
+    bool for_processor = consumer_bits & CONSUMER_BIT(kAfeConsumerProcessor);
+
+    srmodel_list_t *models = esp_srmodel_init("model");
+    bool has_wakenet = for_wake_word && models != nullptr && models->num != -1 &&
+        esp_srmodel_filter(models, ESP_WN_PREFIX, NULL) != nullptr;
+    if (for_wake_word && !has_wakenet) {
+        ESP_LOGE(TAG, "No wakenet model found");
+        return false;
+    }
+
+    // Wakenet only runs in the speech recognition pipeline, without it keep the voice communication one
+    afe_config_t* afe_config;
+    if (has_wakenet) {
+        afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+        afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+    } else {
+        afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
+        afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
+    }
+
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    if (for_processor) {
+        char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
+        char* vad_model_name = esp_srmodel_filter(models, ESP_VADN_PREFIX, NULL);
+        afe_config->ns_init = false;
+        afe_config->vad_mode = VAD_MODE_0;
+        afe_config->vad_min_noise_ms = 100;
+        if (vad_model_name != nullptr) {
+            afe_config->vad_model_name = vad_model_name;
+        }
+        if (ns_model_name != nullptr) {
+            afe_config->ns_init = true;
+            afe_config->ns_model_name = ns_model_name;
+            afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+        }
+        afe_config->agc_init = false;
+#ifdef CONFIG_USE_DEVICE_AEC
+        afe_config->aec_init = true;
+        afe_config->vad_init = false;
+        device_aec_enabled_ = true;
+#else
+        // The wake word cancels the speaker echo whenever the codec provides a reference channel
+        afe_config->aec_init = has_wakenet && has_reference_;
+        afe_config->vad_init = true;
+#endif
+    } else {
+        // A wake word pipeline of its own keeps the SR defaults for NS, VAD and AGC
+        afe_config->aec_init = has_reference_;
+    }
+
+    auto pipeline = std::make_unique<Pipeline>();
+    pipeline->owner = this;
+    pipeline->consumer_bits = consumer_bits;
+    pipeline->has_wakenet = has_wakenet;
+    pipeline->aec_available = afe_config->aec_init;
+    // VAD is switched for the processor only, a wake word pipeline of its own leaves it as configured
+    pipeline->vad_available = for_processor && afe_config->vad_init;
+    pipeline->iface = esp_afe_handle_from_config(afe_config);
+    pipeline->data = pipeline->iface->create_from_config(afe_config);
+    if (pipeline->data == nullptr) {
+        ESP_LOGE(TAG, "Failed to create AFE");
+        return false;
+    }
+    pipelines_[consumer] = pipeline.get();
+    ConfigureStages(pipeline.get());
+
+    xTaskCreate([](void* arg) {
+        auto pipeline = (Pipeline*)arg;
+        pipeline->owner->FetchTask(pipeline);
+        vTaskDelete(NULL);
+    }, GetTaskName(consumer), 4096, pipeline.get(), 3, nullptr);
+    pipeline_storage_[consumer] = std::move(pipeline);
+    return true;
+}
+
+void AfeHost::Subscribe(AfeConsumer consumer, std::function<void(const afe_fetch_result_t* result)> callback) {
+    callbacks_[consumer] = callback;
+}
+
+void AfeHost::SetConsumerActive(AfeConsumer consumer, bool active) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active) {
+        xEventGroupSetBits(event_group_, CONSUMER_BIT(consumer));
+    } else {
+        xEventGroupClearBits(event_group_, CONSUMER_BIT(consumer));
+    }
+    auto pipeline = pipelines_[consumer];
+    if (pipeline == nullptr) {
+        return;
+    }
+    ConfigureStages(pipeline);
+    // Nobody listens to this pipeline anymore, drop the buffered audio so the next consumer starts fresh
+    if ((xEventGroupGetBits(event_group_) & pipeline->consumer_bits) == 0) {
+        pipeline->iface->reset_buffer(pipeline->data);
+    }
+}
+
+bool AfeHost::IsConsumerActive(AfeConsumer consumer) {
+    return xEventGroupGetBits(event_group_) & CONSUMER_BIT(consumer);
+}
+
+void AfeHost::EnableDeviceAec(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    device_aec_enabled_ = enable;
+    if (pipelines_[kAfeConsumerProcessor] != nullptr) {
+        ConfigureStages(pipelines_[kAfeConsumerProcessor]);
+    }
+}
+
+// Must be called with mutex_ held
+void AfeHost::ConfigureStages(Pipeline* pipeline) {
+    auto bits = xEventGroupGetBits(event_group_) & pipeline->consumer_bits;
+    if (pipeline->has_wakenet) {
+        if (bits & CONSUMER_BIT(kAfeConsumerWakeWord)) {
+            pipeline->iface->enable_wakenet(pipeline->data);
+        } else {
+            pipeline->iface->disable_wakenet(pipeline->data);
+        }
+    }
+
+    bool aec;
+    bool vad;
+    if (bits & CONSUMER_BIT(kAfeConsumerProcessor)) {
+        aec = device_aec_enabled_;
+        vad = !device_aec_enabled_;
+    } else if (bits & CONSUMER_BIT(kAfeConsumerWakeWord)) {
+        aec = has_reference_;
+        vad = false;
+    } else {
+        return;
+    }
+    if (pipeline->aec_available) {
+        if (aec) {
+            pipeline->iface->enable_aec(pipeline->data);
+        } else {
+            pipeline->iface->disable_aec(pipeline->data);
+        }
+    }
+    if (pipeline->vad_available) {
+        if (vad) {
+            pipeline->iface->enable_vad(pipeline->data);
+        } else {
+            pipeline->iface->disable_vad(pipeline->data);
+        }
+    }
+}
+
+void AfeHost::Feed(AfeConsumer consumer, const std::vector<int16_t>& data) {
+    auto pipeline = pipelines_[consumer];
+    if (pipeline == nullptr) {
+        return;
+    }
+    pipeline->iface->feed(pipeline->data, data.data());
+}
+
+size_t AfeHost::GetFeedSize(AfeConsumer consumer) {
+    auto pipeline = pipelines_[consumer];
+    if (pipeline == nullptr) {
+        return 0;
+    }
+    return pipeline->iface->get_feed_chunksize(pipeline->data) * codec_->input_channels();
+}
+
+void AfeHost::FetchTask(Pipeline* pipeline) {
+    auto fetch_size = pipeline->iface->get_fetch_chunksize(pipeline->data);
+    auto feed_size = pipeline->iface->get_feed_chunksize(pipeline->data);
+    ESP_LOGI(TAG, "AFE task started, feed size: %d fetch size: %d wakenet: %d",
+        feed_size, fetch_size, pipeline->has_wakenet);
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, pipeline->consumer_bits, pdFALSE, pdFALSE, portMAX_DELAY);
+
+        auto res = pipeline->iface->fetch_with_delay(pipeline->data, portMAX_DELAY);
+        auto bits = xEventGroupGetBits(event_group_) & pipeline->consumer_bits;
+        if (bits == 0) {
+            continue;
+        }
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < kAfeConsumerCount; i++) {
+            if ((bits & CONSUMER_BIT(i)) && callbacks_[i]) {
+                callbacks_[i](res);
+            }
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef AFE_HOST_H
+#define AFE_HOST_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <esp_afe_sr_models.h>
+#include <esp_nsn_models.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
+
+#include "audio_codec.h"
+
+enum AfeConsumer {
+    kAfeConsumerWakeWord,
+    kAfeConsumerProcessor,
+    kAfeConsumerCount
+};
+
+// Owns the esp-sr AFE pipelines of the wake word and the audio processor, which
+// subscribe to the output of their pipeline instead of running their own fetch task.
+// With CONFIG_USE_AFE_SHARED_PIPELINE both consumers share one speech recognition
+// pipeline, which switches its wakenet, AEC and VAD stages for whichever consumer is
+// active. That halves the AFE memory and keeps the filters converged from idle to
+// listening, but the uplink then goes through the SR AEC instead of the voice
+// communication one. Otherwise each consumer gets a pipeline of its own: SR with
+// wakenet for the wake word and VC for the audio processor.
+class AfeHost {
+public:
+    static AfeHost& GetInstance() {
+        static AfeHost instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    AfeHost(const AfeHost&) = delete;
+    AfeHost& operator=(const AfeHost&) = delete;
+
+    // Creates the consumer's pipeline on the first call, later calls only return whether
+    // it exists. A shared pipeline is created by the first consumer, so the wake word must
+    // initialize first for it to include wakenet
+    bool Initialize(AfeConsumer consumer, AudioCodec* codec);
+    // The callback runs on the fetch task for every result while the consumer is active
+    void Subscribe(AfeConsumer consumer, std::function<void(const afe_fetch_result_t* result)> callback);
+    void SetConsumerActive(AfeConsumer consumer, bool active);
+    bool IsConsumerActive(AfeConsumer consumer);
+    void Feed(AfeConsumer consumer, const std::vector<int16_t>& data);
+    size_t GetFeedSize(AfeConsumer consumer);
+    // Applies to the processor consumer, device AEC replaces VAD while it is on
+    void EnableDeviceAec(bool enable);
+    // The task that runs the consumer's pipeline, for CPU profiling
+    static const char* GetTaskName(AfeConsumer consumer);
+
+private:
+    struct Pipeline {
+        AfeHost* owner = nullptr;
+        esp_afe_sr_iface_t* iface = nullptr;
+        esp_afe_sr_data_t* data = nullptr;
+        EventBits_t consumer_bits = 0;  // Consumers served by this pipeline
+        bool has_wakenet = false;
+        bool aec_available = false;
+        bool vad_available = false;
+    };
+
+    AfeHost();
+    ~AfeHost();
+
+    AudioCodec* codec_ = nullptr;
+    EventGroupHandle_t event_group_ = nullptr;
+    std::array<std::function<void(const afe_fetch_result_t* result)>, kAfeConsumerCount> callbacks_;
+    std::array<std::unique_ptr<Pipeline>, kAfeConsumerCount> pipeline_storage_;
+    // Pipeline of each consumer, both point to the same one when it is shared
+    std::array<Pipeline*, kAfeConsumerCount> pipelines_ = {};
+    std::mutex mutex_;
+    bool has_reference_ = false;
+    bool device_aec_enabled_ = false;
+
+    bool CreatePipeline(AfeConsumer consumer);
+    void ConfigureStages(Pipeline* pipeline);
+    void FetchTask(Pipeline* pipeline);
+};
+
+#endif // AFE_HOST_H
@@ -1,38 +1,45 @@
 #include "afe_wake_word.h"
 #include "application.h"
+#include "latency_tracker.h"
 
 #include <esp_log.h>
 #include <model_path.h>
 #include <arpa/inet.h>
 #include <sstream>
-
-#define DETECTION_RUNNING_EVENT 1
+#include <algorithm>
 
 #define TAG "AfeWakeWord"
 
-AfeWakeWord::AfeWakeWord()
-    : afe_data_(nullptr),
-      wake_word_pcm_(),
-      wake_word_opus_() {
+// Audio kept before the wake word for voice recognition on the server
+#define WAKE_WORD_PRE_ROLL_MS 2000
+// Room for the writes that may still land while the pre-roll is read
+#define WAKE_WORD_PRE_ROLL_HEADROOM_MS 200
+#define WAKE_WORD_PRE_ROLL_PACKETS (WAKE_WORD_PRE_ROLL_MS / OPUS_FRAME_DURATION_MS)
+#define WAKE_WORD_FRAME_SAMPLES (16000 * OPUS_FRAME_DURATION_MS / 1000)
 
-    event_group_ = xEventGroupCreate();
+#if CONFIG_WAKE_WORD_PRE_ROLL_ENCODE_CONTINUOUS
+// Encoding while idle keeps a ring of the last pre-roll
+#define WAKE_WORD_OPUS_QUEUE_PACKETS WAKE_WORD_PRE_ROLL_PACKETS
+#else
+#define WAKE_WORD_OPUS_QUEUE_PACKETS 0
+#endif
+
+AfeWakeWord::AfeWakeWord()
+    : wake_word_pcm_(16000 * (WAKE_WORD_PRE_ROLL_MS + WAKE_WORD_PRE_ROLL_HEADROOM_MS) / 1000),
+      wake_word_opus_(WAKE_WORD_OPUS_QUEUE_PACKETS) {
 }
 
 AfeWakeWord::~AfeWakeWord() {
-    if (afe_data_ != nullptr) {
-        afe_iface_->destroy(afe_data_);
+    if (wake_word_encode_task_ != nullptr) {
+        vTaskDelete(wake_word_encode_task_);
     }
-
     if (wake_word_encode_task_stack_ != nullptr) {
         heap_caps_free(wake_word_encode_task_stack_);
     }
-
-    vEventGroupDelete(event_group_);
 }
 
 void AfeWakeWord::Initialize(AudioCodec* codec) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
 
     srmodel_list_t *models = esp_srmodel_init("model");
     if (models == nullptr || models->num == -1) {
@@ -53,28 +60,22 @@ void AfeWakeWord::Initialize(AudioCodec* codec) {
         }
     }
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
+    // The AFE host runs the pipeline and enables wakenet while detection runs
+    if (!AfeHost::GetInstance().Initialize(kAfeConsumerWakeWord, codec_)) {
+        return;
     }
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
-    afe_config->aec_init = codec_->input_reference();
-    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
-    afe_config->afe_perferred_core = 1;
-    afe_config->afe_perferred_priority = 1;
-    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
-    
-    afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
+    afe_host_ = &AfeHost::GetInstance();
+    afe_host_->Subscribe(kAfeConsumerWakeWord, [this](const afe_fetch_result_t* res) {
+        OnAfeResult(res);
+    });
 
-    xTaskCreate([](void* arg) {
+    // The encoder task lives as long as the wake word, its stack is in PSRAM
+    wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
         auto this_ = (AfeWakeWord*)arg;
-        this_->AudioDetectionTask();
+        this_->PreRollEncodeTask();
         vTaskDelete(NULL);
-    }, "audio_detection", 4096, this, 3, nullptr);
+    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
 }
 
 void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -82,111 +83,178 @@ void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
 }
 
 void AfeWakeWord::StartDetection() {
-    xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+#if CONFIG_WAKE_WORD_PRE_ROLL_ENCODE_CONTINUOUS
+    // Packets left from the previous detection are stale, start a new pre-roll
+    if (wake_word_encode_task_ != nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(wake_word_mutex_);
+            reset_requested_ = true;
+            reset_position_ = wake_word_pcm_.write_position();
+        }
+        xTaskNotifyGive(wake_word_encode_task_);
+    }
+#endif
+    AfeHost::GetInstance().SetConsumerActive(kAfeConsumerWakeWord, true);
 }
 
 void AfeWakeWord::StopDetection() {
-    xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
-    if (afe_data_ != nullptr) {
-        afe_iface_->reset_buffer(afe_data_);
-    }
+    AfeHost::GetInstance().SetConsumerActive(kAfeConsumerWakeWord, false);
 }
 
 bool AfeWakeWord::IsDetectionRunning() {
-    return xEventGroupGetBits(event_group_) & DETECTION_RUNNING_EVENT;
+    return AfeHost::GetInstance().IsConsumerActive(kAfeConsumerWakeWord);
 }
 
 void AfeWakeWord::Feed(const std::vector<int16_t>& data) {
-    if (afe_data_ == nullptr) {
+    if (afe_host_ == nullptr) {
         return;
     }
-    afe_iface_->feed(afe_data_, data.data());
+    afe_host_->Feed(kAfeConsumerWakeWord, data);
 }
 
 size_t AfeWakeWord::GetFeedSize() {
-    if (afe_data_ == nullptr) {
+    if (afe_host_ == nullptr) {
         return 0;
     }
-    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+    return afe_host_->GetFeedSize(kAfeConsumerWakeWord);
 }
 
-void AfeWakeWord::AudioDetectionTask() {
-    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
-    ESP_LOGI(TAG, "Audio detection task started, feed size: %d fetch size: %d",
-        feed_size, fetch_size);
-
-    while (true) {
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
-
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
-        if (res == nullptr || res->ret_value == ESP_FAIL) {
-            continue;;
-        }
-
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+// Runs on the AFE fetch task
+void AfeWakeWord::OnAfeResult(const afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            StopDetection();
-            last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        StopDetection();
+        last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
+        LatencyTracker::GetInstance().BeginTurn(kLatencyStageWakeWord);
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
     }
 }
 
 void AfeWakeWord::StoreWakeWordData(const int16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 30ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 30) {
-        wake_word_pcm_.pop_front();
+    // The ring buffer is allocated once, storing a frame does not touch the heap
+    wake_word_pcm_.Write(data, samples);
+#if CONFIG_WAKE_WORD_PRE_ROLL_ENCODE_CONTINUOUS
+    if (wake_word_encode_task_ != nullptr) {
+        xTaskNotifyGive(wake_word_encode_task_);
     }
+#endif
 }
 
 void AfeWakeWord::EncodeWakeWordData() {
-    wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    if (wake_word_encode_task_ == nullptr) {
+        PushWakeWordOpus(std::vector<uint8_t>());
+        return;
     }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (AfeWakeWord*)arg;
+    {
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+#if CONFIG_WAKE_WORD_PRE_ROLL_ENCODE_CONTINUOUS
+        // Most of the pre-roll is encoded already and can be taken right away
+        wake_word_opus_.Freeze();
+#else
+        wake_word_opus_.Clear();
+#endif
+        encode_requested_ = true;
+    }
+    xTaskNotifyGive(wake_word_encode_task_);
+}
+
+void AfeWakeWord::PreRollEncodeTask() {
+    auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    encoder->SetComplexity(0); // 0 is the fastest
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        bool encode_requested;
+        bool reset_requested;
+        uint64_t reset_position;
         {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
-
-            int packets = 0;
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-                packets++;
-            }
-            this_->wake_word_pcm_.clear();
+            std::lock_guard<std::mutex> lock(wake_word_mutex_);
+            encode_requested = encode_requested_;
+            reset_requested = reset_requested_;
+            reset_position = reset_position_;
+            encode_requested_ = false;
+            reset_requested_ = false;
+        }
+
+#if CONFIG_WAKE_WORD_PRE_ROLL_ENCODE_CONTINUOUS
+        if (reset_requested) {
+            encoder->ResetState();
+            // Start from where detection restarted, frames stored since then belong to the new pre-roll
+            encoded_position_ = reset_position;
+            // A detection right after the restart already froze the new pre-roll
+            wake_word_opus_.Clear(!encode_requested);
+        }
+        EncodeNewFrames(encoder.get());
+        if (encode_requested) {
+            PushWakeWordOpus(std::vector<uint8_t>());
+        }
+#else
+        (void)reset_requested;
+        if (encode_requested) {
+            encoder->ResetState();
+            EncodePreRoll(encoder.get());
+            PushWakeWordOpus(std::vector<uint8_t>());
+        }
+#endif
+    }
+}
+
+// Encodes the whole pre-roll after detection, packets are handed out as soon as each is ready
+void AfeWakeWord::EncodePreRoll(OpusEncoderWrapper* encoder) {
+    auto start_time = esp_timer_get_time();
+    // Read the pre-roll in place, one encoder frame at a time
+    auto snapshot = wake_word_pcm_.GetSnapshot(16000 * WAKE_WORD_PRE_ROLL_MS / 1000);
+    int packets = 0;
+    for (size_t offset = 0; offset < snapshot.size(); offset += WAKE_WORD_FRAME_SAMPLES) {
+        std::vector<int16_t> pcm(std::min<size_t>(WAKE_WORD_FRAME_SAMPLES, snapshot.size() - offset));
+        if (!wake_word_pcm_.Read(snapshot, offset, pcm.data(), pcm.size())) {
+            ESP_LOGW(TAG, "Wake word data overwritten after %d packets", packets);
+            break;
+        }
+        encoder->Encode(std::move(pcm), [this](std::vector<uint8_t>&& opus) {
+            PushWakeWordOpus(std::move(opus));
+        });
+        packets++;
+    }
+    wake_word_pcm_.Clear();
 
-            auto end_time = esp_timer_get_time();
-            ESP_LOGI(TAG, "Encode wake word opus %d packets in %ld ms", packets, (long)((end_time - start_time) / 1000));
+    auto end_time = esp_timer_get_time();
+    ESP_LOGI(TAG, "Encode wake word opus %d packets in %ld ms", packets, (long)((end_time - start_time) / 1000));
+}
 
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
+// Encodes the frames completed since the last call, while idle the packets form a ring of the last pre-roll
+void AfeWakeWord::EncodeNewFrames(OpusEncoderWrapper* encoder) {
+    auto snapshot = wake_word_pcm_.GetSnapshot(wake_word_pcm_.write_position() - encoded_position_);
+    if (snapshot.position != encoded_position_) {
+        // Fell behind by more than the buffer holds, continue from the oldest sample kept
+        encoded_position_ = snapshot.position;
+    }
+    size_t offset = 0;
+    while (snapshot.size() - offset >= WAKE_WORD_FRAME_SAMPLES) {
+        std::vector<int16_t> pcm(WAKE_WORD_FRAME_SAMPLES);
+        if (!wake_word_pcm_.Read(snapshot, offset, pcm.data(), pcm.size())) {
+            ESP_LOGW(TAG, "Wake word data overwritten before it was encoded");
+            encoded_position_ = wake_word_pcm_.write_position();
+            return;
         }
-        vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+        encoder->Encode(std::move(pcm), [this](std::vector<uint8_t>&& opus) {
+            PushWakeWordOpus(std::move(opus));
+        });
+        offset += WAKE_WORD_FRAME_SAMPLES;
+    }
+    encoded_position_ += offset;
+}
+
+void AfeWakeWord::PushWakeWordOpus(std::vector<uint8_t>&& opus) {
+    wake_word_opus_.Push(std::move(opus));
 }
 
 bool AfeWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
-    std::unique_lock<std::mutex> lock(wake_word_mutex_);
-    wake_word_cv_.wait(lock, [this]() {
-        return !wake_word_opus_.empty();
-    });
-    opus.swap(wake_word_opus_.front());
-    wake_word_opus_.pop_front();
-    return !opus.empty();
+    return wake_word_opus_.Pop(opus);
 }
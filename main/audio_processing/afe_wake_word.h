@@ -8,15 +8,19 @@
 #include <esp_afe_sr_models.h>
 #include <esp_nsn_models.h>
 
-#include <list>
 #include <string>
 #include <vector>
 #include <functional>
 #include <mutex>
-#include <condition_variable>
+#include <memory>
+
+#include <opus_encoder.h>
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "afe_host.h"
+#include "pcm_ring_buffer.h"
+#include "pre_roll_opus_queue.h"
 
 class AfeWakeWord : public WakeWord {
 public:
@@ -35,11 +39,9 @@ public:
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AfeHost* afe_host_ = nullptr;
     char* wakenet_model_ = NULL;
     std::vector<std::string> wake_words_;
-    EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
@@ -47,13 +49,22 @@ private:
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    PcmRingBuffer wake_word_pcm_;
+    PreRollOpusQueue wake_word_opus_;
     std::mutex wake_word_mutex_;
-    std::condition_variable wake_word_cv_;
+    // Requests to the pre-roll encode task, guarded by wake_word_mutex_
+    bool encode_requested_ = false;
+    bool reset_requested_ = false;
+    uint64_t reset_position_ = 0;
+    // Next sample to encode, only used by the encode task
+    uint64_t encoded_position_ = 0;
 
     void StoreWakeWordData(const int16_t* data, size_t size);
-    void AudioDetectionTask();
+    void OnAfeResult(const afe_fetch_result_t* res);
+    void PreRollEncodeTask();
+    void EncodePreRoll(OpusEncoderWrapper* encoder);
+    void EncodeNewFrames(OpusEncoderWrapper* encoder);
+    void PushWakeWordOpus(std::vector<uint8_t>&& opus);
 };
 
 #endif
@@ -0,0 +1,257 @@
+#include "audio_benchmark.h"
+#include "audio_kernels.h"
+#include "polyphase_resampler.h"
+#include "system_info.h"
+#include "application.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_app_desc.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+#include <opus_encoder.h>
+#include <opus_decoder.h>
+#include <cJSON.h>
+#include <algorithm>
+#include <cmath>
+#include <esp_cpu.h>
+
+#define TAG "AudioBenchmark"
+
+#define BENCHMARK_TASK_STACK_SIZE (4096 * 8)
+#define BENCHMARK_TASK_PRIORITY 2
+#define BENCHMARK_FRAME_DURATION_MS 60
+#define BENCHMARK_DONE_EVENT (1 << 0)
+
+static inline uint32_t GetCycleCount() {
+    return esp_cpu_get_cycle_count();
+}
+
+static inline size_t GetFreeHeap() {
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+// A tone with some noise on top, so the encoder does not see trivially compressible input
+static std::vector<int16_t> MakeTestSignal(int sample_rate, int samples) {
+    std::vector<int16_t> pcm(samples);
+    uint32_t seed = 12345;
+    for (int i = 0; i < samples; i++) {
+        seed = seed * 1103515245 + 12345;
+        int noise = static_cast<int>((seed >> 16) & 0x7FF) - 1024;
+        pcm[i] = static_cast<int16_t>(8000.0 * std::sin(2.0 * M_PI * 440.0 * i / sample_rate) + noise);
+    }
+    return pcm;
+}
+
+// 16000 -> "16k", 44100 -> "44.1k"
+static std::string FormatRate(int sample_rate) {
+    std::string text = std::to_string(sample_rate / 1000);
+    if (sample_rate % 1000 != 0) {
+        text += "." + std::to_string(sample_rate % 1000 / 100);
+    }
+    return text + "k";
+}
+
+std::mutex AudioBenchmark::last_results_mutex_;
+std::string AudioBenchmark::last_results_;
+bool AudioBenchmark::running_ = false;
+
+AudioBenchmark::AudioBenchmark(int iterations) : iterations_(std::max(1, iterations)) {
+}
+
+template <typename Body>
+void AudioBenchmark::Measure(std::string name, int samples, size_t heap_before, Body&& body) {
+    uint64_t cycles = 0;
+    int64_t wall_time_us = 0;
+    // The heap tracks its lowest free size while monitoring, which catches the allocations
+    // made and freed inside the body that sampling between iterations would miss
+    heap_caps_monitor_local_minimum_free_size_start();
+    for (int i = 0; i < iterations_; i++) {
+        int64_t start_time = esp_timer_get_time();
+        uint32_t start_cycles = GetCycleCount();
+        body();
+        cycles += static_cast<uint32_t>(GetCycleCount() - start_cycles);
+        wall_time_us += esp_timer_get_time() - start_time;
+    }
+    size_t lowest_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    heap_caps_monitor_local_minimum_free_size_stop();
+    results_.push_back(AudioBenchmarkResult{
+        .name = std::move(name),
+        .samples = samples,
+        .cycles = cycles,
+        .wall_time_us = wall_time_us,
+        .peak_heap_bytes = heap_before > lowest_free ? heap_before - lowest_free : 0
+    });
+}
+
+void AudioBenchmark::RunAll() {
+    const int frame_samples = 16000 * BENCHMARK_FRAME_DURATION_MS / 1000;
+    const auto pcm = MakeTestSignal(16000, frame_samples);
+    std::vector<uint8_t> packet;
+
+    {
+        size_t heap_before = GetFreeHeap();
+        OpusEncoderWrapper encoder(16000, 1, BENCHMARK_FRAME_DURATION_MS);
+        encoder.SetComplexity(0);
+        Measure("opus_encode_16k_c0", frame_samples, heap_before, [&]() {
+            encoder.Encode(std::vector<int16_t>(pcm), [&](std::vector<uint8_t>&& opus) {
+                packet = std::move(opus);
+            });
+        });
+        encoder.ResetState();
+        encoder.SetComplexity(5);
+        Measure("opus_encode_16k_c5", frame_samples, heap_before, [&]() {
+            encoder.Encode(std::vector<int16_t>(pcm), [&](std::vector<uint8_t>&& opus) {
+                packet = std::move(opus);
+            });
+        });
+    }
+
+    {
+        size_t heap_before = GetFreeHeap();
+        OpusDecoderWrapper decoder(16000, 1, BENCHMARK_FRAME_DURATION_MS);
+        std::vector<int16_t> output;
+        Measure("opus_decode_16k", frame_samples, heap_before, [&]() {
+            decoder.Decode(std::vector<uint8_t>(packet), output);
+        });
+    }
+
+    // Every rate pair the resampler may meet: server and asset rates, codec rates and
+    // 44.1 kHz media, cycles are per 60 ms frame at the input rate
+    static const int rates[] = { 16000, 24000, 44100, 48000 };
+    for (int input_rate : rates) {
+        for (int output_rate : rates) {
+            if (input_rate == output_rate) {
+                continue;
+            }
+            const int input_samples = input_rate * BENCHMARK_FRAME_DURATION_MS / 1000;
+            const auto input = MakeTestSignal(input_rate, input_samples);
+            auto name = "resample_" + FormatRate(input_rate) + "_" + FormatRate(output_rate);
+            size_t heap_before = GetFreeHeap();
+            PolyphaseResampler resampler;
+            resampler.Configure(input_rate, output_rate);
+            std::vector<int16_t> output(resampler.GetOutputSamples(input_samples) + 1);
+            Measure(std::move(name), input_samples, heap_before, [&]() {
+                resampler.Process(input.data(), input.size(), output.data());
+            });
+        }
+    }
+
+    // NoAudioCodec write and read conversions for a 24 kHz frame
+    {
+        const int samples = 24000 * BENCHMARK_FRAME_DURATION_MS / 1000;
+        const auto input = MakeTestSignal(24000, samples);
+        size_t heap_before = GetFreeHeap();
+        std::vector<int32_t> wide(samples);
+        std::vector<int16_t> narrow(samples);
+        Measure("scale_to_int32", samples, heap_before, [&]() {
+            ScaleToInt32(input.data(), wide.data(), samples, 40000);
+        });
+        Measure("shift_to_int16", samples, heap_before, [&]() {
+            ShiftToInt16(wide.data(), narrow.data(), samples, 12);
+        });
+    }
+
+    // Application::ReadAudio splits the microphone and reference channels of a stereo frame
+    {
+        const auto stereo = MakeTestSignal(16000, frame_samples * 2);
+        size_t heap_before = GetFreeHeap();
+        std::vector<int16_t> left(frame_samples);
+        std::vector<int16_t> right(frame_samples);
+        Measure("deinterleave_stereo", frame_samples, heap_before, [&]() {
+            DeinterleaveStereo(stereo.data(), left.data(), right.data(), frame_samples);
+        });
+    }
+}
+
+std::string AudioBenchmark::GetResultsJson() const {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "version", esp_app_get_description()->version);
+    cJSON_AddStringToObject(root, "target", SystemInfo::GetChipModelName().c_str());
+    cJSON_AddNumberToObject(root, "iterations", iterations_);
+    cJSON* results = cJSON_CreateArray();
+    for (const auto& result : results_) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", result.name.c_str());
+        cJSON_AddNumberToObject(item, "samples", result.samples);
+        cJSON_AddNumberToObject(item, "cycles", static_cast<double>(result.cycles / iterations_));
+        cJSON_AddNumberToObject(item, "wall_time_us", static_cast<double>(result.wall_time_us) / iterations_);
+        cJSON_AddNumberToObject(item, "peak_heap_bytes", result.peak_heap_bytes);
+        cJSON_AddItemToArray(results, item);
+    }
+    cJSON_AddItemToObject(root, "results", results);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+std::string AudioBenchmark::Run() {
+    {
+        std::lock_guard<std::mutex> lock(last_results_mutex_);
+        if (running_) {
+            return "{\"error\":\"A benchmark is already running\"}";
+        }
+        running_ = true;
+    }
+    results_.clear();
+    EventGroupHandle_t event_group = xEventGroupCreate();
+    auto context = std::make_pair(this, event_group);
+    BaseType_t created = xTaskCreate([](void* arg) {
+        auto context = static_cast<std::pair<AudioBenchmark*, EventGroupHandle_t>*>(arg);
+        context->first->RunAll();
+        xEventGroupSetBits(context->second, BENCHMARK_DONE_EVENT);
+        vTaskDelete(NULL);
+    }, "audio_benchmark", BENCHMARK_TASK_STACK_SIZE, &context, BENCHMARK_TASK_PRIORITY, nullptr);
+    if (created != pdPASS) {
+        vEventGroupDelete(event_group);
+        ESP_LOGE(TAG, "Failed to create benchmark task");
+        std::lock_guard<std::mutex> lock(last_results_mutex_);
+        running_ = false;
+        return "{\"error\":\"Failed to create benchmark task\"}";
+    }
+    xEventGroupWaitBits(event_group, BENCHMARK_DONE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+    vEventGroupDelete(event_group);
+    return Finish();
+}
+
+bool AudioBenchmark::StartInBackground(int iterations) {
+    {
+        std::lock_guard<std::mutex> lock(last_results_mutex_);
+        if (running_) {
+            return false;
+        }
+        running_ = true;
+    }
+    // The encode lane has the priority of the live encoder and a stack big enough for Opus
+    Application::GetInstance().GetBackgroundTask()->Schedule([iterations]() {
+        AudioBenchmark benchmark(iterations);
+        benchmark.RunAll();
+        benchmark.Finish();
+    }, kBackgroundTaskLaneEncode);
+    return true;
+}
+
+std::string AudioBenchmark::GetLastResultsJson() {
+    std::lock_guard<std::mutex> lock(last_results_mutex_);
+    if (running_) {
+        return "{\"running\":true}";
+    }
+    if (last_results_.empty()) {
+        return "{\"error\":\"No benchmark has run yet\"}";
+    }
+    return last_results_;
+}
+
+std::string AudioBenchmark::Finish() {
+    // Results are per iteration, the log line is meant to be collected from the serial output
+    auto json = GetResultsJson();
+    ESP_LOGI(TAG, "BENCHMARK %s", json.c_str());
+    std::lock_guard<std::mutex> lock(last_results_mutex_);
+    last_results_ = json;
+    running_ = false;
+    return json;
+}
@@ -0,0 +1,50 @@
+#ifndef AUDIO_BENCHMARK_H
+#define AUDIO_BENCHMARK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+
+struct AudioBenchmarkResult {
+    std::string name;
+    int samples;            // Samples processed per iteration
+    uint64_t cycles;        // CPU cycles summed over all iterations
+    int64_t wall_time_us;   // Wall time summed over all iterations
+    size_t peak_heap_bytes; // Peak heap use while the case ran, including the objects under test.
+                            // The heap low-water mark is system wide, so other tasks add to it
+};
+
+// Times the audio hot paths (Opus encode and decode, resampling and the codec and
+// capture sample kernels) on fixed synthetic input, so that results are comparable
+// across releases. Reports one JSON document, which is also written to the log and kept
+// for GetLastResultsJson.
+class AudioBenchmark {
+public:
+    AudioBenchmark(int iterations);
+
+    // Runs on a task of its own with the priority of the encode lane and waits for it
+    std::string Run();
+    // Runs on the encode lane of the background task and returns right away, false while
+    // a run is still going. The encode lane is idle unless the device is listening
+    static bool StartInBackground(int iterations);
+    // The results of the last finished run, {"running":true} while one is going
+    static std::string GetLastResultsJson();
+
+private:
+    int iterations_;
+    std::vector<AudioBenchmarkResult> results_;
+
+    static std::mutex last_results_mutex_;
+    static std::string last_results_;
+    static bool running_;
+
+    void RunAll();
+    std::string Finish();
+    template <typename Body>
+    void Measure(std::string name, int samples, size_t heap_before, Body&& body);
+    std::string GetResultsJson() const;
+};
+
+#endif // AUDIO_BENCHMARK_H
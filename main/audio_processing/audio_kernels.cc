@@ -0,0 +1,83 @@
+#include "audio_kernels.h"
+
+#include <cstring>
+
+// The kernels move two 16-bit samples per 32-bit load/store, which halves the
+// memory operations compared to a per-sample loop on both Xtensa and RISC-V.
+// memcpy keeps the word accesses well defined for unaligned buffers and is
+// lowered to single load/store instructions by the compiler.
+
+static inline uint32_t Load32(const int16_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void Store32(int16_t* p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+void DeinterleaveStereo(const int16_t* src, int16_t* left, int16_t* right, size_t frames) {
+    size_t i = 0;
+    for (; i + 2 <= frames; i += 2) {
+        // Little endian: low half is the first sample in memory
+        uint32_t a = Load32(src + i * 2);      // L0 R0
+        uint32_t b = Load32(src + i * 2 + 2);  // L1 R1
+        Store32(left + i, (a & 0xFFFF) | (b << 16));
+        Store32(right + i, (a >> 16) | (b & 0xFFFF0000));
+    }
+    for (; i < frames; i++) {
+        left[i] = src[i * 2];
+        right[i] = src[i * 2 + 1];
+    }
+}
+
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* dst, size_t frames) {
+    size_t i = 0;
+    for (; i + 2 <= frames; i += 2) {
+        uint32_t l = Load32(left + i);   // L0 L1
+        uint32_t r = Load32(right + i);  // R0 R1
+        Store32(dst + i * 2, (l & 0xFFFF) | (r << 16));
+        Store32(dst + i * 2 + 2, (l >> 16) | (r & 0xFFFF0000));
+    }
+    for (; i < frames; i++) {
+        dst[i * 2] = left[i];
+        dst[i * 2 + 1] = right[i];
+    }
+}
+
+void ScaleToInt32(const int16_t* src, int32_t* dst, size_t samples, int32_t gain) {
+    // |sample * gain| <= 32768 * 65536 = 2^31, and only -32768 * 65536 reaches it, which
+    // is exactly INT32_MIN. So a plain 32-bit multiply can not overflow and no clamping
+    // is needed. Unrolled by 4 to keep the multiplier pipeline busy.
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        dst[i] = src[i] * gain;
+        dst[i + 1] = src[i + 1] * gain;
+        dst[i + 2] = src[i + 2] * gain;
+        dst[i + 3] = src[i + 3] * gain;
+    }
+    for (; i < samples; i++) {
+        dst[i] = src[i] * gain;
+    }
+}
+
+static inline int16_t ClampToInt16(int32_t value) {
+    // Symmetric range, -32768 is never produced
+    value = value > INT16_MAX ? INT16_MAX : value;
+    value = value < -INT16_MAX ? -INT16_MAX : value;
+    return (int16_t)value;
+}
+
+void ShiftToInt16(const int32_t* src, int16_t* dst, size_t samples, int shift) {
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        dst[i] = ClampToInt16(src[i] >> shift);
+        dst[i + 1] = ClampToInt16(src[i + 1] >> shift);
+        dst[i + 2] = ClampToInt16(src[i + 2] >> shift);
+        dst[i + 3] = ClampToInt16(src[i + 3] >> shift);
+    }
+    for (; i < samples; i++) {
+        dst[i] = ClampToInt16(src[i] >> shift);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Split interleaved L/R frames into two planar buffers
+void DeinterleaveStereo(const int16_t* src, int16_t* left, int16_t* right, size_t frames);
+// Merge two planar buffers into interleaved L/R frames
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* dst, size_t frames);
+// Widen samples to 32 bits scaled by a Q16 gain, gain must be within [0, 65536]
+void ScaleToInt32(const int16_t* src, int32_t* dst, size_t samples, int32_t gain);
+// Narrow 32-bit samples by an arithmetic right shift, clamped to [-INT16_MAX, INT16_MAX]
+void ShiftToInt16(const int32_t* src, int16_t* dst, size_t samples, int shift);
+
+#endif // AUDIO_KERNELS_H
@@ -0,0 +1,109 @@
+#include "encoder_governor.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "EncoderGovernor"
+
+// Encode time is judged as a percentage of the frame duration
+#define OVERLOAD_AVERAGE_PERCENT 50
+#define OVERLOAD_PEAK_PERCENT 90
+#define QUIET_AVERAGE_PERCENT 25
+// Consecutive quiet windows needed before complexity is raised by one
+#define QUIET_WINDOWS_TO_STEP_UP 3
+// Consecutive windows with a short send queue needed before DTX is turned off again
+#define CLEAR_WINDOWS_TO_RELEASE_DTX 5
+
+void EncoderGovernor::Configure(int frame_duration_ms, int initial_complexity, int max_complexity) {
+    frame_duration_us_ = frame_duration_ms * 1000;
+    window_frames_ = std::max(1, 1000 / frame_duration_ms);
+    max_complexity_ = std::clamp(max_complexity, 0, 10);
+    complexity_ = std::clamp(initial_complexity, 0, max_complexity_);
+    dtx_ = false;
+    window_count_ = 0;
+    window_total_us_ = 0;
+    window_peak_us_ = 0;
+    window_max_depth_ = 0;
+    quiet_windows_ = 0;
+    clear_windows_ = 0;
+    ESP_LOGI(TAG, "Complexity %d, max %d, window %d frames", complexity_, max_complexity_, window_frames_);
+}
+
+bool EncoderGovernor::OnFrameEncoded(int64_t encode_time_us, size_t send_queue_depth, size_t send_queue_capacity) {
+    stats_.frames++;
+    window_count_++;
+    window_total_us_ += encode_time_us;
+    window_peak_us_ = std::max(window_peak_us_, encode_time_us);
+    window_max_depth_ = std::max(window_max_depth_, send_queue_depth);
+    window_capacity_ = send_queue_capacity;
+    if (window_count_ < window_frames_) {
+        return false;
+    }
+
+    bool changed = EvaluateWindow();
+    window_count_ = 0;
+    window_total_us_ = 0;
+    window_peak_us_ = 0;
+    window_max_depth_ = 0;
+    return changed;
+}
+
+bool EncoderGovernor::EvaluateWindow() {
+    int average_us = window_total_us_ / window_count_;
+    stats_.last_average_us = average_us;
+    stats_.last_peak_us = window_peak_us_;
+
+    bool changed = false;
+    bool overloaded = average_us * 100 > frame_duration_us_ * OVERLOAD_AVERAGE_PERCENT ||
+        window_peak_us_ * 100 > frame_duration_us_ * OVERLOAD_PEAK_PERCENT;
+    // Half of the send queue in use means the link is not keeping up with the encoder
+    bool congested = window_capacity_ > 0 && window_max_depth_ * 2 >= window_capacity_;
+
+    if (overloaded) {
+        quiet_windows_ = 0;
+        if (complexity_ > 0) {
+            complexity_ = std::max(0, complexity_ - 2);
+            stats_.complexity_downs++;
+            changed = true;
+            ESP_LOGW(TAG, "Encode time %d/%d us per frame, complexity down to %d",
+                average_us, frame_duration_us_, complexity_);
+        }
+    } else if (!congested && average_us * 100 < frame_duration_us_ * QUIET_AVERAGE_PERCENT) {
+        if (++quiet_windows_ >= QUIET_WINDOWS_TO_STEP_UP && complexity_ < max_complexity_) {
+            complexity_++;
+            quiet_windows_ = 0;
+            stats_.complexity_ups++;
+            changed = true;
+            ESP_LOGI(TAG, "Encode time %d/%d us per frame, complexity up to %d",
+                average_us, frame_duration_us_, complexity_);
+        }
+    } else {
+        quiet_windows_ = 0;
+    }
+
+    // The encoder has no bitrate control, DTX is what shrinks the uplink during pauses
+    if (congested) {
+        stats_.congested_windows++;
+        clear_windows_ = 0;
+        if (!dtx_) {
+            dtx_ = true;
+            stats_.dtx_switches++;
+            changed = true;
+            ESP_LOGW(TAG, "Send queue %u/%u, enable DTX", (unsigned)window_max_depth_, (unsigned)window_capacity_);
+        }
+    } else if (dtx_ && ++clear_windows_ >= CLEAR_WINDOWS_TO_RELEASE_DTX) {
+        dtx_ = false;
+        clear_windows_ = 0;
+        stats_.dtx_switches++;
+        changed = true;
+        ESP_LOGI(TAG, "Send queue drained, disable DTX");
+    }
+    return changed;
+}
+
+void EncoderGovernor::PrintStats() const {
+    ESP_LOGI(TAG, "frames: %lu complexity: %d (max %d) dtx: %d encode: %d/%d us downs: %lu ups: %lu dtx switches: %lu congested: %lu",
+        (unsigned long)stats_.frames, complexity_, max_complexity_, dtx_, stats_.last_average_us, stats_.last_peak_us,
+        (unsigned long)stats_.complexity_downs, (unsigned long)stats_.complexity_ups,
+        (unsigned long)stats_.dtx_switches, (unsigned long)stats_.congested_windows);
+}
@@ -0,0 +1,52 @@
+#ifndef ENCODER_GOVERNOR_H
+#define ENCODER_GOVERNOR_H
+
+#include <cstdint>
+#include <cstddef>
+
+struct EncoderGovernorStats {
+    uint32_t frames = 0;
+    uint32_t complexity_downs = 0;
+    uint32_t complexity_ups = 0;
+    uint32_t dtx_switches = 0;
+    uint32_t congested_windows = 0;
+    int last_average_us = 0;
+    int last_peak_us = 0;
+};
+
+// Picks the Opus encoder complexity and DTX from the measured encode time per frame
+// and the depth of the uplink send queue. Each decision is taken over a window of
+// about one second: overload steps down at once, recovery only after several quiet
+// windows in a row so the settings do not flap.
+// Not thread safe, it is expected to be fed from the encode task only.
+class EncoderGovernor {
+public:
+    void Configure(int frame_duration_ms, int initial_complexity, int max_complexity);
+    // Returns true when complexity or DTX changed and should be applied to the encoder
+    bool OnFrameEncoded(int64_t encode_time_us, size_t send_queue_depth, size_t send_queue_capacity);
+    void PrintStats() const;
+
+    inline int complexity() const { return complexity_; }
+    inline bool dtx() const { return dtx_; }
+    inline const EncoderGovernorStats& stats() const { return stats_; }
+
+private:
+    EncoderGovernorStats stats_;
+    int frame_duration_us_ = 60000;
+    int window_frames_ = 16;
+    int complexity_ = 0;
+    int max_complexity_ = 0;
+    bool dtx_ = false;
+
+    int window_count_ = 0;
+    int64_t window_total_us_ = 0;
+    int64_t window_peak_us_ = 0;
+    size_t window_max_depth_ = 0;
+    size_t window_capacity_ = 0;
+    int quiet_windows_ = 0;
+    int clear_windows_ = 0;
+
+    bool EvaluateWindow();
+};
+
+#endif // ENCODER_GOVERNOR_H
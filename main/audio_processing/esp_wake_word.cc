@@ -1,5 +1,6 @@
 #include "esp_wake_word.h"
 #include "application.h"
+#include "latency_tracker.h"
 
 #include <esp_log.h>
 #include <model_path.h>
@@ -67,6 +68,7 @@ void EspWakeWord::Feed(const std::vector<int16_t>& data) {
     if (res > 0) {
         StopDetection();
         last_detected_wake_word_ = wakenet_iface_->get_word_name(wakenet_data_, res);
+        LatencyTracker::GetInstance().BeginTurn(kLatencyStageWakeWord);
 
         if (wake_word_detected_callback_) {
             wake_word_detected_callback_(last_detected_wake_word_);
@@ -0,0 +1,86 @@
+#include "pcm_ring_buffer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "PcmRingBuffer"
+
+PcmRingBuffer::PcmRingBuffer(size_t capacity) : capacity_(capacity) {
+    buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (buffer_ == nullptr) {
+        buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u samples", (unsigned)capacity_);
+        capacity_ = 0;
+    }
+}
+
+PcmRingBuffer::~PcmRingBuffer() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+void PcmRingBuffer::Write(const int16_t* data, size_t samples) {
+    if (capacity_ == 0) {
+        return;
+    }
+    uint64_t written = written_.load(std::memory_order_relaxed);
+    // Only the tail of an oversized write survives
+    if (samples > capacity_) {
+        data += samples - capacity_;
+        written += samples - capacity_;
+        samples = capacity_;
+    }
+    if (samples > max_write_size_.load(std::memory_order_relaxed)) {
+        max_write_size_.store(samples, std::memory_order_relaxed);
+    }
+    size_t index = written % capacity_;
+    size_t head = std::min(samples, capacity_ - index);
+    memcpy(buffer_ + index, data, head * sizeof(int16_t));
+    memcpy(buffer_, data + head, (samples - head) * sizeof(int16_t));
+    written_.store(written + samples, std::memory_order_release);
+}
+
+void PcmRingBuffer::Clear() {
+    cleared_at_.store(written_.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+PcmRingBuffer::Snapshot PcmRingBuffer::GetSnapshot(size_t samples) const {
+    Snapshot snapshot;
+    uint64_t written = written_.load(std::memory_order_acquire);
+    samples = std::min(samples, size());
+    if (samples == 0) {
+        snapshot.position = written;
+        return snapshot;
+    }
+    snapshot.position = written - samples;
+    size_t index = snapshot.position % capacity_;
+    size_t head = std::min(samples, capacity_ - index);
+    snapshot.first = std::span<const int16_t>(buffer_ + index, head);
+    snapshot.second = std::span<const int16_t>(buffer_, samples - head);
+    return snapshot;
+}
+
+bool PcmRingBuffer::IsIntact(const Snapshot& snapshot, size_t offset) const {
+    // A write in progress is not published yet, so leave room for one more write of the largest size
+    uint64_t written = written_.load(std::memory_order_acquire);
+    return written + max_write_size_.load(std::memory_order_relaxed) <= snapshot.position + offset + capacity_;
+}
+
+bool PcmRingBuffer::Read(const Snapshot& snapshot, size_t offset, int16_t* dest, size_t samples) const {
+    if (offset + samples > snapshot.size()) {
+        return false;
+    }
+    if (offset < snapshot.first.size()) {
+        size_t head = std::min(samples, snapshot.first.size() - offset);
+        memcpy(dest, snapshot.first.data() + offset, head * sizeof(int16_t));
+        memcpy(dest + head, snapshot.second.data(), (samples - head) * sizeof(int16_t));
+    } else {
+        memcpy(dest, snapshot.second.data() + offset - snapshot.first.size(), samples * sizeof(int16_t));
+    }
+    return IsIntact(snapshot, offset);
+}
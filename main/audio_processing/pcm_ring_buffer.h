@@ -0,0 +1,60 @@
+#ifndef PCM_RING_BUFFER_H
+#define PCM_RING_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <span>
+
+// A fixed-size circular buffer of PCM samples, allocated once (in PSRAM when available).
+// One task writes, any task may take a snapshot of the most recent samples and read it
+// in place. The buffer is never locked: a snapshot records the absolute write position,
+// and IsIntact tells whether the writer has since wrapped over the snapshot, so a reader
+// copies a piece out first and checks it afterwards. A snapshot is only safe while it
+// leaves room for one more write, so size the buffer with headroom above the snapshot.
+class PcmRingBuffer {
+public:
+    struct Snapshot {
+        uint64_t position = 0;            // Absolute index of the first sample
+        std::span<const int16_t> first;   // The oldest samples
+        std::span<const int16_t> second;  // The rest after the wrap, may be empty
+
+        inline size_t size() const { return first.size() + second.size(); }
+    };
+
+    PcmRingBuffer(size_t capacity);
+    ~PcmRingBuffer();
+    // 删除拷贝构造函数和赋值运算符
+    PcmRingBuffer(const PcmRingBuffer&) = delete;
+    PcmRingBuffer& operator=(const PcmRingBuffer&) = delete;
+
+    // Single writer only, overwrites the oldest samples when full
+    void Write(const int16_t* data, size_t samples);
+    // Drops the buffered samples from later snapshots
+    void Clear();
+    // Returns up to the last `samples` samples written
+    Snapshot GetSnapshot(size_t samples) const;
+    // Whether the samples of the snapshot from offset on have not been overwritten yet
+    bool IsIntact(const Snapshot& snapshot, size_t offset = 0) const;
+    // Copies samples of the snapshot starting at offset, returns false if the writer overwrote them meanwhile
+    bool Read(const Snapshot& snapshot, size_t offset, int16_t* dest, size_t samples) const;
+
+    inline size_t capacity() const { return capacity_; }
+    // Absolute index of the next sample to be written
+    inline uint64_t write_position() const { return written_.load(std::memory_order_acquire); }
+    inline size_t size() const;
+
+private:
+    int16_t* buffer_ = nullptr;
+    size_t capacity_;
+    std::atomic<uint64_t> written_ = 0;
+    std::atomic<size_t> max_write_size_ = 0;
+    std::atomic<uint64_t> cleared_at_ = 0;
+};
+
+inline size_t PcmRingBuffer::size() const {
+    uint64_t written = written_.load(std::memory_order_acquire) - cleared_at_.load(std::memory_order_relaxed);
+    return written < capacity_ ? written : capacity_;
+}
+
+#endif // PCM_RING_BUFFER_H
@@ -0,0 +1,143 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <mutex>
+#include <numeric>
+#include <algorithm>
+
+#define TAG "PolyphaseResampler"
+
+// Taps per phase for interpolation, decimation scales it up to keep the transition band
+#define POLYPHASE_BASE_TAPS 16
+// Passband edge relative to the lower Nyquist frequency
+#define POLYPHASE_CUTOFF 0.9
+
+void PolyphaseResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    int divisor = std::gcd(input_sample_rate, output_sample_rate);
+    int interpolation = output_sample_rate / divisor;
+    int decimation = input_sample_rate / divisor;
+
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    bank_ = GetFilterBank(interpolation, decimation);
+    Reset();
+    ESP_LOGI(TAG, "Resampling %d -> %d Hz, L=%d M=%d taps=%d, group delay %d us", input_sample_rate, output_sample_rate,
+        interpolation, decimation, bank_->taps_per_phase, GetGroupDelayUs());
+}
+
+void PolyphaseResampler::Reset() {
+    phase_ = 0;
+    history_.assign(bank_ ? bank_->taps_per_phase - 1 : 0, 0);
+}
+
+int PolyphaseResampler::GetOutputSamples(int input_samples) const {
+    if (!bank_) {
+        return 0;
+    }
+    // Outputs k >= 0 with phase_ + k * M < input_samples * L
+    int64_t end = (int64_t)input_samples * bank_->interpolation;
+    if (end <= phase_) {
+        return 0;
+    }
+    return (end - phase_ + bank_->decimation - 1) / bank_->decimation;
+}
+
+int PolyphaseResampler::GetGroupDelayUs() const {
+    if (!bank_) {
+        return 0;
+    }
+    // (N - 1) / 2 samples at the upsampled rate, N = L * K
+    int64_t length = (int64_t)bank_->interpolation * bank_->taps_per_phase;
+    return (length - 1) * 1000000LL / (2LL * bank_->interpolation * input_sample_rate_);
+}
+
+int PolyphaseResampler::Process(const int16_t* input, int input_samples, int16_t* output) {
+    if (!bank_) {
+        return 0;
+    }
+    const int interpolation = bank_->interpolation;
+    const int decimation = bank_->decimation;
+    const int taps = bank_->taps_per_phase;
+    const int16_t* coefficients = bank_->coefficients.data();
+
+    // history_ keeps capacity, so this only allocates when the block size grows
+    size_t history_size = taps - 1;
+    history_.resize(history_size + input_samples);
+    std::copy(input, input + input_samples, history_.begin() + history_size);
+
+    int count = 0;
+    int64_t end = (int64_t)input_samples * interpolation;
+    for (int64_t position = phase_; position < end; position += decimation) {
+        int index = position / interpolation;
+        int phase = position % interpolation;
+        // x[index - K + 1 .. index] sits at history_[index .. index + K - 1]
+        const int16_t* x = history_.data() + index;
+        const int16_t* h = coefficients + phase * taps;
+        int32_t acc = 1 << 14;
+        for (int j = 0; j < taps; j++) {
+            acc += x[j] * h[j];
+        }
+        acc >>= 15;
+        output[count++] = acc > INT16_MAX ? INT16_MAX : acc < INT16_MIN ? INT16_MIN : acc;
+        phase_ = position + decimation;
+    }
+    phase_ -= end;
+
+    // Keep the tail for the next block
+    std::copy(history_.end() - history_size, history_.end(), history_.begin());
+    history_.resize(history_size);
+    return count;
+}
+
+std::shared_ptr<const PolyphaseResampler::FilterBank> PolyphaseResampler::GetFilterBank(int interpolation, int decimation) {
+    // Only the few rate pairs a device actually uses end up here, so banks are kept for good
+    static std::mutex mutex;
+    static std::vector<std::shared_ptr<const FilterBank>> banks;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& bank : banks) {
+        if (bank->interpolation == interpolation && bank->decimation == decimation) {
+            return bank;
+        }
+    }
+    auto bank = DesignFilterBank(interpolation, decimation);
+    banks.push_back(bank);
+    return bank;
+}
+
+std::shared_ptr<const PolyphaseResampler::FilterBank> PolyphaseResampler::DesignFilterBank(int interpolation, int decimation) {
+    auto bank = std::make_shared<FilterBank>();
+    bank->interpolation = interpolation;
+    bank->decimation = decimation;
+    bank->taps_per_phase = POLYPHASE_BASE_TAPS * std::max(1, (decimation + interpolation - 1) / interpolation);
+
+    // Blackman windowed sinc at the upsampled rate, cut off below the lower Nyquist
+    const int taps = bank->taps_per_phase;
+    const int length = interpolation * taps;
+    const double cutoff = POLYPHASE_CUTOFF * 0.5 / std::max(interpolation, decimation);
+    const double center = (length - 1) / 2.0;
+    std::vector<double> prototype(length);
+    for (int n = 0; n < length; n++) {
+        double t = n - center;
+        double sinc = t == 0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        double window = 0.42 - 0.5 * cos(2.0 * M_PI * n / (length - 1)) + 0.08 * cos(4.0 * M_PI * n / (length - 1));
+        prototype[n] = sinc * window * interpolation;
+    }
+
+    // Split into phases, normalize each to unity DC gain and store reversed, so the
+    // inner loop walks input and coefficients in the same direction
+    bank->coefficients.resize(length);
+    for (int phase = 0; phase < interpolation; phase++) {
+        double sum = 0;
+        for (int j = 0; j < taps; j++) {
+            sum += prototype[j * interpolation + phase];
+        }
+        for (int j = 0; j < taps; j++) {
+            double value = prototype[j * interpolation + phase] / sum * 32768.0;
+            value = std::clamp(round(value), (double)INT16_MIN, (double)INT16_MAX);
+            bank->coefficients[phase * taps + (taps - 1 - j)] = (int16_t)value;
+        }
+    }
+    return bank;
+}
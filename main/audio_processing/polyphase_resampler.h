@@ -0,0 +1,50 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+
+// Streaming rational resampler (L/M polyphase FIR) for 16/24/44.1/48 kHz conversions.
+// State carries over between Process calls, so consecutive blocks are filtered as one
+// continuous stream. The filter bank of a rate pair is designed once and shared by all
+// instances that use the same pair, so reconfiguring between known rates is free.
+class PolyphaseResampler {
+public:
+    PolyphaseResampler() = default;
+
+    void Configure(int input_sample_rate, int output_sample_rate);
+    // Clears the history and phase, keeps the filter bank
+    void Reset();
+    // Exact number of samples the next Process call produces for this input size
+    int GetOutputSamples(int input_samples) const;
+    // Writes GetOutputSamples(input_samples) samples to output and returns that count
+    int Process(const int16_t* input, int input_samples, int16_t* output);
+
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+    // Delay of the linear phase filter, to be compensated when aligning streams for AEC
+    int GetGroupDelayUs() const;
+
+private:
+    struct FilterBank {
+        int interpolation;      // L
+        int decimation;         // M
+        int taps_per_phase;     // K
+        std::vector<int16_t> coefficients;  // L phases x K taps, Q15, reversed per phase
+    };
+
+    static std::shared_ptr<const FilterBank> GetFilterBank(int interpolation, int decimation);
+    static std::shared_ptr<const FilterBank> DesignFilterBank(int interpolation, int decimation);
+
+    std::shared_ptr<const FilterBank> bank_;
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    // Position of the next output sample in the current block, in 1/L input samples
+    int64_t phase_ = 0;
+    // The last K - 1 input samples followed by the current block
+    std::vector<int16_t> history_;
+};
+
+#endif // POLYPHASE_RESAMPLER_H
@@ -0,0 +1,45 @@
+#include "pre_roll_opus_queue.h"
+
+PreRollOpusQueue::PreRollOpusQueue(size_t max_packets) : max_packets_(max_packets) {
+}
+
+void PreRollOpusQueue::Push(std::vector<uint8_t>&& opus) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const bool end_marker = opus.empty();
+    packets_.emplace_back(std::move(opus));
+    // The end marker is never trimmed, the reader may already be waiting for it
+    if (max_packets_ > 0 && !frozen_ && !end_marker) {
+        while (packets_.size() > max_packets_) {
+            packets_.pop_front();
+        }
+    }
+    cv_.notify_all();
+}
+
+bool PreRollOpusQueue::Pop(std::vector<uint8_t>& opus) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() {
+        return !packets_.empty();
+    });
+    opus.swap(packets_.front());
+    packets_.pop_front();
+    return !opus.empty();
+}
+
+void PreRollOpusQueue::Freeze() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frozen_ = true;
+}
+
+void PreRollOpusQueue::Clear(bool unfreeze) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    packets_.clear();
+    if (unfreeze) {
+        frozen_ = false;
+    }
+}
+
+size_t PreRollOpusQueue::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return packets_.size();
+}
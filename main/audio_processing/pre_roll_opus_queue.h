@@ -0,0 +1,38 @@
+#ifndef PRE_ROLL_OPUS_QUEUE_H
+#define PRE_ROLL_OPUS_QUEUE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// Opus packets of the audio before the wake word, handed from the encode task to the sender.
+// An empty packet marks the end of the pre-roll. With a packet limit, only the newest packets
+// are kept until the queue is frozen, so encoding while idle holds just the last pre-roll.
+class PreRollOpusQueue {
+public:
+    // 0 keeps every packet
+    explicit PreRollOpusQueue(size_t max_packets = 0);
+
+    void Push(std::vector<uint8_t>&& opus);
+    // Waits for a packet, returns false on the end marker
+    bool Pop(std::vector<uint8_t>& opus);
+    // Keeps every packet from now on, the pre-roll is being sent
+    void Freeze();
+    // Drops the queued packets, and trims again if unfreeze is set
+    void Clear(bool unfreeze = true);
+
+    size_t size() const;
+    inline size_t max_packets() const { return max_packets_; }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::list<std::vector<uint8_t>> packets_;
+    size_t max_packets_;
+    bool frozen_ = false;
+};
+
+#endif // PRE_ROLL_OPUS_QUEUE_H
@@ -0,0 +1,369 @@
+#include "wake_word_profiler.h"
+#include "application.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "WakeWordProfiler"
+
+// A detection counts for a labeled wake word if it fires this close to the end of it
+#define REPLAY_MATCH_BEFORE_MS 500
+#define REPLAY_MATCH_AFTER_MS 2000
+// Silence fed after the file so the last detections can come out of the pipeline
+#define REPLAY_TAIL_MS 1000
+
+WakeWordProfiler::WakeWordProfiler(std::unique_ptr<WakeWord> backend, const std::string& name, const char* processing_task)
+    : backend_(std::move(backend)), name_(name), processing_task_(processing_task) {
+}
+
+void WakeWordProfiler::Initialize(AudioCodec* codec) {
+    codec_ = codec;
+    backend_->Initialize(codec);
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    // The backend creates its processing task in Initialize
+    if (processing_task_ != nullptr) {
+        processing_task_handle_ = xTaskGetHandle(processing_task_);
+    }
+#endif
+}
+
+// The run time stats clock is esp_timer by default, so the counter is in microseconds
+configRUN_TIME_COUNTER_TYPE WakeWordProfiler::GetTaskRunTime() {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    if (processing_task_handle_ != nullptr) {
+        return ulTaskGetRunTimeCounter(processing_task_handle_);
+    }
+#endif
+    return 0;
+}
+
+// Must be called with mutex_ held. The unsigned difference stays correct across one wrap
+void WakeWordProfiler::AccumulateLiveTaskRunTime() {
+    if (!live_detection_ || replaying_) {
+        return;
+    }
+    auto now = GetTaskRunTime();
+    live_stats_.task_run_time += static_cast<configRUN_TIME_COUNTER_TYPE>(now - live_task_run_time_last_);
+    live_task_run_time_last_ = now;
+}
+
+void WakeWordProfiler::TimedFeed(const std::vector<int16_t>& data, WakeWordProfileStats& stats) {
+    auto start_time = esp_timer_get_time();
+    backend_->Feed(data);
+    auto feed_time_us = esp_timer_get_time() - start_time;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.frames++;
+    stats.samples += data.size() / codec_->input_channels();
+    stats.feed_time_us += feed_time_us;
+    stats.peak_feed_time_us = std::max(stats.peak_feed_time_us, feed_time_us);
+}
+
+void WakeWordProfiler::Feed(const std::vector<int16_t>& data) {
+    // The microphone is not listened to during a replay
+    if (replaying_) {
+        return;
+    }
+    TimedFeed(data, live_stats_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    AccumulateLiveTaskRunTime();
+}
+
+void WakeWordProfiler::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
+    wake_word_detected_callback_ = callback;
+    backend_->OnWakeWordDetected([this](const std::string& wake_word) {
+        if (replaying_) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                replay_stats_.detections++;
+                replay_stats_.detection_positions.push_back(replay_stats_.samples);
+            }
+            // Backends stop themselves on detection, keep going through the rest of the file
+            backend_->StartDetection();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            live_stats_.detections++;
+            live_stats_.detection_positions.push_back(live_stats_.samples);
+            if (live_stats_.detection_positions.size() > 16) {
+                live_stats_.detection_positions.erase(live_stats_.detection_positions.begin());
+            }
+            // The backend stopped itself, so stop charging the task's run time to it
+            AccumulateLiveTaskRunTime();
+            live_detection_ = false;
+        }
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(wake_word);
+        }
+    });
+}
+
+void WakeWordProfiler::StartDetection() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!live_detection_) {
+        live_task_run_time_last_ = GetTaskRunTime();
+    }
+    live_detection_ = true;
+    if (!replaying_) {
+        backend_->StartDetection();
+    }
+}
+
+void WakeWordProfiler::StopDetection() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AccumulateLiveTaskRunTime();
+    live_detection_ = false;
+    if (!replaying_) {
+        backend_->StopDetection();
+    }
+}
+
+bool WakeWordProfiler::IsDetectionRunning() {
+    return !replaying_ && backend_->IsDetectionRunning();
+}
+
+size_t WakeWordProfiler::GetFeedSize() {
+    return backend_->GetFeedSize();
+}
+
+void WakeWordProfiler::EncodeWakeWordData() {
+    backend_->EncodeWakeWordData();
+}
+
+bool WakeWordProfiler::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+    return backend_->GetWakeWordOpus(opus);
+}
+
+const std::string& WakeWordProfiler::GetLastDetectedWakeWord() const {
+    return backend_->GetLastDetectedWakeWord();
+}
+
+std::string WakeWordProfiler::GetStatsJson() {
+    WakeWordProfileStats stats;
+    WakeWordProfileStats replay_stats;
+    std::string replay_result;
+    bool replaying;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        AccumulateLiveTaskRunTime();
+        stats = live_stats_;
+        replaying = replaying_;
+        if (replaying) {
+            replay_stats = replay_stats_;
+        } else {
+            replay_result = replay_result_;
+        }
+    }
+
+    cJSON* root = CreateStatsJson(stats, nullptr);
+    if (replaying) {
+        // Scored so far, the labels past the current position count as misses until reached
+        cJSON* replay = CreateStatsJson(replay_stats, &replay_labels_ms_);
+        cJSON_AddStringToObject(replay, "path", replay_path_.c_str());
+        cJSON_AddBoolToObject(replay, "running", true);
+        cJSON_AddItemToObject(root, "replay", replay);
+    } else if (!replay_result.empty()) {
+        cJSON_AddItemToObject(root, "replay", cJSON_Parse(replay_result.c_str()));
+    }
+    return PrintJson(root);
+}
+
+std::string WakeWordProfiler::PrintJson(cJSON* root) {
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+cJSON* WakeWordProfiler::CreateStatsJson(const WakeWordProfileStats& stats, const std::vector<int>* labels_ms) {
+    double audio_hours = stats.samples / 16000.0 / 3600.0;
+    int frames = std::max<int>(1, stats.frames);
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "backend", name_.c_str());
+    cJSON_AddNumberToObject(root, "audio_seconds", stats.samples / 16000.0);
+    cJSON_AddNumberToObject(root, "frames", stats.frames);
+    cJSON_AddNumberToObject(root, "feed_us_per_frame", static_cast<double>(stats.feed_time_us) / frames);
+    cJSON_AddNumberToObject(root, "peak_feed_us", static_cast<double>(stats.peak_feed_time_us));
+    if (processing_task_ != nullptr) {
+        cJSON_AddStringToObject(root, "processing_task", processing_task_);
+        cJSON_AddNumberToObject(root, "task_us_per_frame", static_cast<double>(stats.task_run_time) / frames);
+    }
+    cJSON_AddNumberToObject(root, "detections", stats.detections);
+    if (stats.aborted) {
+        cJSON_AddBoolToObject(root, "aborted", true);
+    }
+
+    if (labels_ms == nullptr) {
+        // Nobody says the wake word most of the time, so this approximates false accepts
+        cJSON_AddNumberToObject(root, "detections_per_hour", audio_hours > 0 ? stats.detections / audio_hours : 0);
+    } else {
+        // Match each detection to the first unmatched wake word it is close enough to
+        std::vector<bool> matched(labels_ms->size(), false);
+        int false_accepts = 0;
+        int64_t total_latency_ms = 0;
+        int max_latency_ms = 0;
+        int accepts = 0;
+        for (auto position : stats.detection_positions) {
+            int detection_ms = position / 16;
+            bool found = false;
+            for (size_t i = 0; i < labels_ms->size(); i++) {
+                int label_ms = (*labels_ms)[i];
+                if (!matched[i] && detection_ms >= label_ms - REPLAY_MATCH_BEFORE_MS && detection_ms <= label_ms + REPLAY_MATCH_AFTER_MS) {
+                    matched[i] = true;
+                    found = true;
+                    accepts++;
+                    total_latency_ms += detection_ms - label_ms;
+                    max_latency_ms = std::max(max_latency_ms, detection_ms - label_ms);
+                    break;
+                }
+            }
+            if (!found) {
+                false_accepts++;
+            }
+        }
+        cJSON_AddNumberToObject(root, "wake_words", labels_ms->size());
+        cJSON_AddNumberToObject(root, "accepts", accepts);
+        cJSON_AddNumberToObject(root, "misses", labels_ms->size() - accepts);
+        cJSON_AddNumberToObject(root, "false_accepts", false_accepts);
+        cJSON_AddNumberToObject(root, "false_accepts_per_hour", audio_hours > 0 ? false_accepts / audio_hours : 0);
+        cJSON_AddNumberToObject(root, "average_latency_ms", accepts > 0 ? static_cast<double>(total_latency_ms) / accepts : 0);
+        cJSON_AddNumberToObject(root, "max_latency_ms", max_latency_ms);
+    }
+    return root;
+}
+
+void WakeWordProfiler::ReplayFile(FILE* file) {
+    int channels = codec_->input_channels();
+    size_t feed_size = backend_->GetFeedSize();
+    size_t frame_samples = feed_size / channels;
+    std::vector<int16_t> mono(frame_samples);
+    // The recording is the microphone channel, the reference channel stays silent
+    std::vector<int16_t> frame(feed_size, 0);
+
+    backend_->StartDetection();
+    auto task_run_time_last = GetTaskRunTime();
+    int64_t start_time = esp_timer_get_time();
+    size_t tail_samples = 16000 * REPLAY_TAIL_MS / 1000;
+    while (true) {
+        // The device may leave idle meanwhile, a button press or a server command, give way to it
+        if (Application::GetInstance().GetDeviceState() != kDeviceStateIdle) {
+            ESP_LOGW(TAG, "The device left idle, replay aborted");
+            std::lock_guard<std::mutex> lock(mutex_);
+            replay_stats_.aborted = true;
+            break;
+        }
+        size_t read = fread(mono.data(), sizeof(int16_t), frame_samples, file);
+        if (read < frame_samples) {
+            if (tail_samples < frame_samples) {
+                break;
+            }
+            std::fill(mono.begin() + read, mono.end(), 0);
+            tail_samples -= frame_samples - read;
+        }
+        for (size_t i = 0; i < frame_samples; i++) {
+            frame[i * channels] = mono[i];
+        }
+        TimedFeed(frame, replay_stats_);
+        auto task_run_time = GetTaskRunTime();
+        int64_t due_us;
+        {
+            // GetStatsJson reads the progress meanwhile
+            std::lock_guard<std::mutex> lock(mutex_);
+            replay_stats_.task_run_time += static_cast<configRUN_TIME_COUNTER_TYPE>(task_run_time - task_run_time_last);
+            due_us = replay_stats_.samples * 1000000 / 16000;
+        }
+        task_run_time_last = task_run_time;
+
+        // Feed in real time, the backends drop audio that comes faster than they process it
+        int64_t ahead_us = due_us - (esp_timer_get_time() - start_time);
+        if (ahead_us > 1000) {
+            vTaskDelay(pdMS_TO_TICKS(ahead_us / 1000));
+        }
+    }
+    backend_->StopDetection();
+    std::lock_guard<std::mutex> lock(mutex_);
+    replay_stats_.task_run_time += static_cast<configRUN_TIME_COUNTER_TYPE>(GetTaskRunTime() - task_run_time_last);
+}
+
+std::string WakeWordProfiler::StartReplay(const std::string& path) {
+    if (replaying_) {
+        return "{\"error\":\"A replay is already running\"}";
+    }
+    // The backend reports no feed size when it failed to initialize, nothing could be replayed
+    if (backend_->GetFeedSize() / codec_->input_channels() == 0) {
+        ESP_LOGE(TAG, "The %s backend takes no input", name_.c_str());
+        return "{\"error\":\"The wake word backend is not running\"}";
+    }
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s", path.c_str());
+        return "{\"error\":\"Failed to open the recording\"}";
+    }
+    std::vector<int> labels_ms;
+    FILE* labels = fopen((path + ".txt").c_str(), "r");
+    if (labels != nullptr) {
+        int label_ms;
+        while (fscanf(labels, "%d", &label_ms) == 1) {
+            labels_ms.push_back(label_ms);
+        }
+        fclose(labels);
+    }
+    ESP_LOGI(TAG, "Replaying %s through %s, %u labeled wake words", path.c_str(), name_.c_str(), (unsigned)labels_ms.size());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Charge the live run time up to now, the replay's share is counted separately
+        AccumulateLiveTaskRunTime();
+        replay_stats_ = WakeWordProfileStats();
+        replay_file_ = file;
+        replay_path_ = path;
+        replay_labels_ms_ = std::move(labels_ms);
+        replaying_ = true;
+        backend_->StopDetection();
+    }
+
+    // Run on a task of our own, a replay takes as long as the recording and the caller's stack may be too small for the backend
+    if (xTaskCreate([](void* arg) {
+        static_cast<WakeWordProfiler*>(arg)->ReplayTask();
+        vTaskDelete(NULL);
+    }, "wake_word_replay", 4096 * 2, this, 5, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the replay task");
+        fclose(file);
+        std::lock_guard<std::mutex> lock(mutex_);
+        replay_file_ = nullptr;
+        replaying_ = false;
+        if (live_detection_) {
+            backend_->StartDetection();
+        }
+        return "{\"error\":\"Failed to start the replay\"}";
+    }
+    return "{\"started\":true}";
+}
+
+void WakeWordProfiler::ReplayTask() {
+    ReplayFile(replay_file_);
+    fclose(replay_file_);
+
+    WakeWordProfileStats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats = replay_stats_;
+    }
+    cJSON* root = CreateStatsJson(stats, &replay_labels_ms_);
+    cJSON_AddStringToObject(root, "path", replay_path_.c_str());
+    auto json = PrintJson(root);
+    ESP_LOGI(TAG, "REPLAY %s", json.c_str());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    replay_result_ = std::move(json);
+    replay_file_ = nullptr;
+    replaying_ = false;
+    if (live_detection_) {
+        live_task_run_time_last_ = GetTaskRunTime();
+        backend_->StartDetection();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef WAKE_WORD_PROFILER_H
+#define WAKE_WORD_PROFILER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <cJSON.h>
+
+#include "wake_word.h"
+
+struct WakeWordProfileStats {
+    uint32_t frames = 0;
+    uint64_t samples = 0;       // Microphone samples per channel
+    int64_t feed_time_us = 0;
+    int64_t peak_feed_time_us = 0;
+    uint64_t task_run_time = 0; // Run time of the processing task, in run time stats clock ticks
+    uint32_t detections = 0;
+    std::vector<uint64_t> detection_positions;
+    bool aborted = false;       // The device left idle before the replay finished
+};
+
+// Wraps a wake word backend to measure what it costs: time spent in Feed, the run time
+// of the backend's own processing task, and how often it fires per hour of audio.
+// Replay feeds a recorded 16 kHz mono PCM file through the backend in real time instead
+// of the microphone, and scores the detections against the wake word end times listed
+// in "<file>.txt" (milliseconds, one per line) for latency and false accepts per hour.
+// A replay runs on a task of its own, its progress and result are part of GetStatsJson.
+class WakeWordProfiler : public WakeWord {
+public:
+    WakeWordProfiler(std::unique_ptr<WakeWord> backend, const std::string& name, const char* processing_task);
+
+    void Initialize(AudioCodec* codec) override;
+    void Feed(const std::vector<int16_t>& data) override;
+    void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) override;
+    void StartDetection() override;
+    void StopDetection() override;
+    bool IsDetectionRunning() override;
+    size_t GetFeedSize() override;
+    void EncodeWakeWordData() override;
+    bool GetWakeWordOpus(std::vector<uint8_t>& opus) override;
+    const std::string& GetLastDetectedWakeWord() const override;
+
+    // Statistics of the live microphone input since boot, and of the running or last replay
+    std::string GetStatsJson();
+    // Starts replaying the file and returns right away, an error JSON if it cannot start.
+    // Live detection is paused until the whole file has been replayed or the device leaves idle
+    std::string StartReplay(const std::string& path);
+
+private:
+    std::unique_ptr<WakeWord> backend_;
+    std::string name_;
+    const char* processing_task_;
+    TaskHandle_t processing_task_handle_ = nullptr;
+    AudioCodec* codec_ = nullptr;
+    std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
+    std::mutex mutex_;
+    WakeWordProfileStats live_stats_;
+    WakeWordProfileStats replay_stats_;
+    std::atomic<bool> replaying_ = false;
+    // Owned by the replay task while replaying_ is set
+    FILE* replay_file_ = nullptr;
+    std::string replay_path_;
+    std::vector<int> replay_labels_ms_;
+    // Result of the last finished replay, guarded by mutex_
+    std::string replay_result_;
+    // Whether the application wants live detection running, applied after a replay
+    bool live_detection_ = false;
+    // The run time counter is 32 bits by default and wraps, so it is read every frame and
+    // only the difference since the last read is added up
+    configRUN_TIME_COUNTER_TYPE live_task_run_time_last_ = 0;
+
+    configRUN_TIME_COUNTER_TYPE GetTaskRunTime();
+    void AccumulateLiveTaskRunTime();
+    void TimedFeed(const std::vector<int16_t>& data, WakeWordProfileStats& stats);
+    void ReplayTask();
+    void ReplayFile(FILE* file);
+    cJSON* CreateStatsJson(const WakeWordProfileStats& stats, const std::vector<int>* labels_ms);
+    std::string PrintJson(cJSON* root);
+};
+
+#endif // WAKE_WORD_PROFILER_H
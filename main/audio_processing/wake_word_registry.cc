@@ -0,0 +1,64 @@
+#include "wake_word_registry.h"
+#include "settings.h"
+
+#include <esp_log.h>
+
+#define TAG "WakeWordRegistry"
+
+void WakeWordRegistry::Register(const std::string& name, const char* processing_task, std::function<std::unique_ptr<WakeWord>()> factory) {
+    backends_.push_back(Backend{
+        .name = name,
+        .processing_task = processing_task,
+        .factory = factory
+    });
+}
+
+const WakeWordRegistry::Backend* WakeWordRegistry::Find(const std::string& name) const {
+    for (auto& backend : backends_) {
+        if (backend.name == name) {
+            return &backend;
+        }
+    }
+    return nullptr;
+}
+
+std::string WakeWordRegistry::GetSelectedName() {
+    Settings settings("wake_word", false);
+    auto name = settings.GetString("backend");
+    if (Find(name) == nullptr && !backends_.empty()) {
+        return backends_.front().name;
+    }
+    return name;
+}
+
+std::unique_ptr<WakeWord> WakeWordRegistry::CreateSelected() {
+    auto backend = Find(GetSelectedName());
+    if (backend == nullptr) {
+        return nullptr;
+    }
+    ESP_LOGI(TAG, "Wake word backend: %s", backend->name.c_str());
+    return backend->factory();
+}
+
+bool WakeWordRegistry::Select(const std::string& name) {
+    if (Find(name) == nullptr) {
+        ESP_LOGE(TAG, "Unknown wake word backend: %s", name.c_str());
+        return false;
+    }
+    Settings settings("wake_word", true);
+    settings.SetString("backend", name);
+    return true;
+}
+
+const char* WakeWordRegistry::GetProcessingTask(const std::string& name) const {
+    auto backend = Find(name);
+    return backend != nullptr ? backend->processing_task : nullptr;
+}
+
+std::vector<std::string> WakeWordRegistry::GetNames() const {
+    std::vector<std::string> names;
+    for (auto& backend : backends_) {
+        names.push_back(backend.name);
+    }
+    return names;
+}
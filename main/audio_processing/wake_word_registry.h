@@ -0,0 +1,47 @@
+#ifndef WAKE_WORD_REGISTRY_H
+#define WAKE_WORD_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "wake_word.h"
+
+// The wake word backends built into the firmware, selectable at runtime by name.
+// Which backends exist still depends on Kconfig and the target, the selection only
+// chooses among them and is stored in NVS, so it applies from the next boot.
+class WakeWordRegistry {
+public:
+    static WakeWordRegistry& GetInstance() {
+        static WakeWordRegistry instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    WakeWordRegistry(const WakeWordRegistry&) = delete;
+    WakeWordRegistry& operator=(const WakeWordRegistry&) = delete;
+
+    // The first backend registered is the default. processing_task names the task that
+    // does the detection work if it is not done inside Feed, for CPU profiling
+    void Register(const std::string& name, const char* processing_task, std::function<std::unique_ptr<WakeWord>()> factory);
+    // Creates the backend selected in settings, or the default one
+    std::unique_ptr<WakeWord> CreateSelected();
+    bool Select(const std::string& name);
+    std::string GetSelectedName();
+    const char* GetProcessingTask(const std::string& name) const;
+    std::vector<std::string> GetNames() const;
+
+private:
+    struct Backend {
+        std::string name;
+        const char* processing_task;
+        std::function<std::unique_ptr<WakeWord>()> factory;
+    };
+    std::vector<Backend> backends_;
+
+    WakeWordRegistry() = default;
+    ~WakeWordRegistry() = default;
+    const Backend* Find(const std::string& name) const;
+};
+
+#endif // WAKE_WORD_REGISTRY_H
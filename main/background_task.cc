@@ -6,54 +6,91 @@
 #define TAG "BackgroundTask"
 
 BackgroundTask::BackgroundTask(uint32_t stack_size) {
-    xTaskCreate([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 2, &background_task_handle_);
+    CreateLane(kBackgroundTaskLaneMisc, "background_task", stack_size, 2, tskNO_AFFINITY);
 }
 
 BackgroundTask::~BackgroundTask() {
-    if (background_task_handle_ != nullptr) {
-        vTaskDelete(background_task_handle_);
+    for (auto& lane : lanes_) {
+        if (lane && lane->task_handle != nullptr) {
+            vTaskDelete(lane->task_handle);
+        }
+    }
+}
+
+void BackgroundTask::ConfigureLane(BackgroundTaskLane lane, const char* name, uint32_t stack_size,
+    UBaseType_t priority, BaseType_t core_id) {
+    if (lanes_[lane]) {
+        ESP_LOGW(TAG, "Lane %s already configured", lanes_[lane]->name);
+        return;
+    }
+    CreateLane(lane, name, stack_size, priority, core_id);
+}
+
+void BackgroundTask::CreateLane(BackgroundTaskLane lane, const char* name, uint32_t stack_size,
+    UBaseType_t priority, BaseType_t core_id) {
+    auto new_lane = std::make_unique<Lane>();
+    new_lane->owner = this;
+    new_lane->name = name;
+    xTaskCreatePinnedToCore([](void* arg) {
+        Lane* lane = (Lane*)arg;
+        lane->owner->BackgroundTaskLoop(lane);
+    }, name, stack_size, new_lane.get(), priority, &new_lane->task_handle, core_id);
+    lanes_[lane] = std::move(new_lane);
+}
+
+BackgroundTask::Lane* BackgroundTask::GetLane(BackgroundTaskLane lane) {
+    if (lanes_[lane]) {
+        return lanes_[lane].get();
     }
+    return lanes_[kBackgroundTaskLaneMisc].get();
 }
 
-void BackgroundTask::Schedule(std::function<void()> callback) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (active_tasks_ >= 30) {
+void BackgroundTask::Schedule(std::function<void()> callback, BackgroundTaskLane lane_id) {
+    Lane* lane = GetLane(lane_id);
+    std::lock_guard<std::mutex> lock(lane->mutex);
+    if (lane->active_tasks >= 30) {
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         if (free_sram < 10000) {
-            ESP_LOGW(TAG, "active_tasks_ == %u, free_sram == %u", active_tasks_.load(), free_sram);
+            ESP_LOGW(TAG, "%s active_tasks == %u, free_sram == %u", lane->name, lane->active_tasks.load(), free_sram);
         }
     }
-    active_tasks_++;
-    background_tasks_.emplace_back([this, cb = std::move(callback)]() {
+    lane->active_tasks++;
+    lane->tasks.emplace_back([lane, cb = std::move(callback)]() {
         cb();
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            active_tasks_--;
-            if (background_tasks_.empty() && active_tasks_ == 0) {
-                condition_variable_.notify_all();
+            std::lock_guard<std::mutex> lock(lane->mutex);
+            lane->active_tasks--;
+            if (lane->tasks.empty() && lane->active_tasks == 0) {
+                lane->condition_variable.notify_all();
             }
         }
     });
-    condition_variable_.notify_all();
+    lane->condition_variable.notify_all();
 }
 
-void BackgroundTask::WaitForCompletion() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    condition_variable_.wait(lock, [this]() {
-        return background_tasks_.empty() && active_tasks_ == 0;
+void BackgroundTask::WaitForCompletion(BackgroundTaskLane lane_id) {
+    Lane* lane = GetLane(lane_id);
+    std::unique_lock<std::mutex> lock(lane->mutex);
+    lane->condition_variable.wait(lock, [lane]() {
+        return lane->tasks.empty() && lane->active_tasks == 0;
     });
 }
 
-void BackgroundTask::BackgroundTaskLoop() {
-    ESP_LOGI(TAG, "background_task started");
+void BackgroundTask::WaitForCompletion() {
+    for (int i = 0; i < kBackgroundTaskLaneCount; i++) {
+        if (lanes_[i]) {
+            WaitForCompletion((BackgroundTaskLane)i);
+        }
+    }
+}
+
+void BackgroundTask::BackgroundTaskLoop(Lane* lane) {
+    ESP_LOGI(TAG, "%s started", lane->name);
     while (true) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this]() { return !background_tasks_.empty(); });
-        
-        std::list<std::function<void()>> tasks = std::move(background_tasks_);
+        std::unique_lock<std::mutex> lock(lane->mutex);
+        lane->condition_variable.wait(lock, [lane]() { return !lane->tasks.empty(); });
+
+        std::list<std::function<void()>> tasks = std::move(lane->tasks);
         lock.unlock();
 
         for (auto& task : tasks) {
@@ -5,25 +5,49 @@
 #include <freertos/task.h>
 #include <mutex>
 #include <list>
+#include <array>
+#include <memory>
+#include <functional>
 #include <condition_variable>
 #include <atomic>
 
+// Each lane is an independent FIFO served by its own FreeRTOS task, so waiting on
+// one lane (e.g. encode) does not block on work queued in another.
+enum BackgroundTaskLane {
+    kBackgroundTaskLaneMisc,
+    kBackgroundTaskLaneEncode,
+    kBackgroundTaskLaneCount
+};
+
 class BackgroundTask {
 public:
+    // Creates the misc lane, other lanes fall back to it until configured
     BackgroundTask(uint32_t stack_size = 4096 * 2);
     ~BackgroundTask();
 
-    void Schedule(std::function<void()> callback);
+    void ConfigureLane(BackgroundTaskLane lane, const char* name, uint32_t stack_size,
+        UBaseType_t priority, BaseType_t core_id = tskNO_AFFINITY);
+    void Schedule(std::function<void()> callback, BackgroundTaskLane lane = kBackgroundTaskLaneMisc);
+    void WaitForCompletion(BackgroundTaskLane lane);
     void WaitForCompletion();
 
 private:
-    std::mutex mutex_;
-    std::list<std::function<void()>> background_tasks_;
-    std::condition_variable condition_variable_;
-    TaskHandle_t background_task_handle_ = nullptr;
-    std::atomic<size_t> active_tasks_{0};
+    struct Lane {
+        BackgroundTask* owner = nullptr;
+        const char* name = nullptr;
+        std::mutex mutex;
+        std::list<std::function<void()>> tasks;
+        std::condition_variable condition_variable;
+        TaskHandle_t task_handle = nullptr;
+        std::atomic<size_t> active_tasks{0};
+    };
+
+    std::array<std::unique_ptr<Lane>, kBackgroundTaskLaneCount> lanes_;
 
-    void BackgroundTaskLoop();
+    Lane* GetLane(BackgroundTaskLane lane);
+    void CreateLane(BackgroundTaskLane lane, const char* name, uint32_t stack_size,
+        UBaseType_t priority, BaseType_t core_id);
+    void BackgroundTaskLoop(Lane* lane);
 };
 
 #endif
@@ -190,11 +190,13 @@ int AdcPdmAudioCodec::Write(const int16_t* data, int samples) {
 void AdcPdmAudioCodec::Start() {
     Settings settings("audio", false);
     output_volume_ = settings.GetInt("output_volume", output_volume_);
+    saved_output_volume_ = output_volume_;
     if (output_volume_ <= 0) {
         ESP_LOGW(TAG, "Output volume value (%d) is too small, setting to default (10)", output_volume_);
         output_volume_ = 10;
     }
 
+    RegisterI2sCallbacks();
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
 
     EnableInput(true);
@@ -66,6 +66,7 @@ private:
             auto codec = GetAudioCodec();
             if (codec) {
                 ESP_LOGI(TAG, "Disabling audio codec");
+                codec->SaveOutputVolume();
                 codec->EnableInput(false);
                 codec->EnableOutput(false);
                 vTaskDelay(pdMS_TO_TICKS(1000));
@@ -164,6 +165,7 @@ private:
             auto codec = GetAudioCodec();
             if (codec) {
                 ESP_LOGI(TAG, "Disabling audio codec");
+                codec->SaveOutputVolume();
                 codec->EnableInput(false);
                 codec->EnableOutput(false);
                 vTaskDelay(pdMS_TO_TICKS(1000));
@@ -0,0 +1,180 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "JitterBuffer"
+
+// A packet arriving within this time after the buffer ran dry means the stream stalled
+#define UNDERRUN_WINDOW_MS 1000
+// Gaps longer than this are treated as a stream restart instead of being concealed
+#define MAX_CONCEALED_PACKETS 4
+
+static inline int32_t SequenceDiff(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b);
+}
+
+JitterBuffer::JitterBuffer(int min_depth, int max_depth)
+    : min_depth_(min_depth), max_depth_(max_depth) {
+    stats_.target_depth = min_depth_;
+}
+
+void JitterBuffer::UpdateTargetDepth(int frame_duration) {
+    if (frame_duration <= 0) {
+        return;
+    }
+    // Cover twice the smoothed jitter, plus whatever the recent underruns asked for
+    int jitter_ms = jitter_q4_ >> 4;
+    int depth = 1 + (2 * jitter_ms + frame_duration - 1) / frame_duration + underrun_boost_;
+    stats_.jitter_ms = jitter_ms;
+    stats_.target_depth = std::clamp(depth, min_depth_, max_depth_);
+}
+
+void JitterBuffer::Push(AudioStreamPacket&& packet, int64_t now_ms) {
+    // Local sounds are all there at once, they need neither reordering nor buffering
+    if (packet.local_sound) {
+        local_packets_.emplace_back(std::move(packet));
+        return;
+    }
+    if (!packet.has_sequence) {
+        packet.sequence = ++auto_sequence_;
+        packet.has_sequence = true;
+    } else {
+        auto_sequence_ = packet.sequence;
+    }
+
+    if (has_next_sequence_ && SequenceDiff(packet.sequence, next_sequence_) < 0) {
+        stats_.late_packets++;
+        AudioPayloadPool::GetInstance().Release(std::move(packet.payload));
+        return;
+    }
+
+    if (starved_at_ms_ >= 0) {
+        if (!segment_boundary_ && now_ms - starved_at_ms_ < UNDERRUN_WINDOW_MS) {
+            stats_.underruns++;
+            underrun_boost_ = std::min(underrun_boost_ + 1, max_depth_);
+            packets_since_underrun_ = 0;
+        }
+        starved_at_ms_ = -1;
+    }
+
+    // Only late arrivals count as jitter, bursts are absorbed by the buffer anyway.
+    // The pause before a new segment is up to the server, not the network
+    if (last_arrival_ms_ >= 0 && !segment_boundary_) {
+        int delay = static_cast<int>(now_ms - last_arrival_ms_) - packet.frame_duration;
+        if (delay < 0) {
+            delay = 0;
+        }
+        jitter_q4_ += delay - (jitter_q4_ >> 4);
+    }
+    last_arrival_ms_ = now_ms;
+    segment_boundary_ = false;
+
+    if (++packets_since_underrun_ >= 100 && underrun_boost_ > 0) {
+        underrun_boost_--;
+        packets_since_underrun_ = 0;
+    }
+    UpdateTargetDepth(packet.frame_duration);
+    stats_.packets++;
+
+    // Packets almost always arrive in order, so search from the back
+    auto it = packets_.end();
+    while (it != packets_.begin()) {
+        auto prev = std::prev(it);
+        int32_t diff = SequenceDiff(packet.sequence, prev->sequence);
+        if (diff == 0) {
+            stats_.late_packets++;
+            AudioPayloadPool::GetInstance().Release(std::move(packet.payload));
+            return;
+        }
+        if (diff > 0) {
+            break;
+        }
+        it = prev;
+    }
+    packets_.insert(it, std::move(packet));
+}
+
+JitterBufferResult JitterBuffer::Pop(AudioStreamPacket& packet, int64_t now_ms) {
+    // The server stream goes first, local sounds fill in while it is empty or buffering
+    auto result = PopServerPacket(packet, now_ms);
+    if ((result == kJitterBufferEmpty || result == kJitterBufferBuffering) && !local_packets_.empty()) {
+        packet = std::move(local_packets_.front());
+        local_packets_.pop_front();
+        return kJitterBufferPacket;
+    }
+    return result;
+}
+
+JitterBufferResult JitterBuffer::PopServerPacket(AudioStreamPacket& packet, int64_t now_ms) {
+    if (packets_.empty()) {
+        if (playing_) {
+            playing_ = false;
+            starved_at_ms_ = now_ms;
+        }
+        buffering_since_ms_ = -1;
+        return kJitterBufferEmpty;
+    }
+
+    auto& head = packets_.front();
+    if (!playing_) {
+        if (buffering_since_ms_ < 0) {
+            buffering_since_ms_ = now_ms;
+        }
+        // Start anyway once the wait covers the target depth, so short streams still play
+        int max_wait_ms = stats_.target_depth * head.frame_duration;
+        if ((int)packets_.size() < stats_.target_depth && now_ms - buffering_since_ms_ < max_wait_ms) {
+            return kJitterBufferBuffering;
+        }
+        playing_ = true;
+        buffering_since_ms_ = -1;
+    }
+
+    int32_t gap = has_next_sequence_ ? SequenceDiff(head.sequence, next_sequence_) : 0;
+    if (gap <= 0 || gap > MAX_CONCEALED_PACKETS) {
+        packet = std::move(head);
+        packets_.pop_front();
+        next_sequence_ = packet.sequence + 1;
+        has_next_sequence_ = true;
+        last_sample_rate_ = packet.sample_rate;
+        last_frame_duration_ = packet.frame_duration;
+        return kJitterBufferPacket;
+    }
+
+    stats_.lost_packets++;
+    next_sequence_++;
+    packet.sample_rate = last_sample_rate_;
+    packet.frame_duration = last_frame_duration_;
+    packet.timestamp = 0;
+    packet.sequence = 0;
+    packet.has_sequence = false;
+    packet.payload.clear();
+    return kJitterBufferLost;
+}
+
+void JitterBuffer::Clear() {
+    auto& payload_pool = AudioPayloadPool::GetInstance();
+    for (auto& packet : packets_) {
+        payload_pool.Release(std::move(packet.payload));
+    }
+    packets_.clear();
+    for (auto& packet : local_packets_) {
+        payload_pool.Release(std::move(packet.payload));
+    }
+    local_packets_.clear();
+    playing_ = false;
+    segment_boundary_ = false;
+    underrun_boost_ = 0;
+    packets_since_underrun_ = 0;
+    has_next_sequence_ = false;
+    last_arrival_ms_ = -1;
+    buffering_since_ms_ = -1;
+    starved_at_ms_ = -1;
+}
+
+void JitterBuffer::PrintStats() const {
+    ESP_LOGI(TAG, "packets: %lu underruns: %lu late: %lu lost: %lu overflows: %lu jitter: %dms target depth: %d",
+        (unsigned long)stats_.packets, (unsigned long)stats_.underruns, (unsigned long)stats_.late_packets,
+        (unsigned long)stats_.lost_packets, (unsigned long)stats_.overflows, stats_.jitter_ms, stats_.target_depth);
+}
@@ -0,0 +1,81 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <cstdint>
+#include <deque>
+
+#include "protocol.h"
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,
+    kJitterBufferBuffering,  // Waiting to reach the target depth, try again later
+    kJitterBufferPacket,
+    kJitterBufferLost,       // A packet is missing, the returned packet has an empty payload for concealment
+};
+
+struct JitterBufferStats {
+    uint32_t packets = 0;
+    uint32_t underruns = 0;
+    uint32_t late_packets = 0;
+    uint32_t lost_packets = 0;
+    uint32_t overflows = 0;
+    int jitter_ms = 0;
+    int target_depth = 0;
+};
+
+// Reorders downlink packets by sequence number and holds back playback until the
+// buffered depth covers the measured arrival jitter. Packets without a sequence
+// number (has_sequence == false) are numbered in arrival order. Local sounds keep
+// out of the server's sequence space: they wait in a queue of their own and play
+// in arrival order whenever the server stream is empty or buffering.
+// Not thread safe, the owner is expected to guard it with its own mutex.
+class JitterBuffer {
+public:
+    JitterBuffer(int min_depth = 1, int max_depth = 8);
+
+    void Push(AudioStreamPacket&& packet, int64_t now_ms);
+    JitterBufferResult Pop(AudioStreamPacket& packet, int64_t now_ms);
+    // Drops all buffered packets and starts a new stream. The stats and the jitter
+    // estimate are kept, the depth added by past underruns is not
+    void Clear();
+    // The stream pauses after the packets pushed so far (between TTS sentences), so running
+    // dry before the next packet is not counted as an underrun, nor the pause as jitter
+    void MarkSegmentBoundary() { segment_boundary_ = true; }
+    void CountOverflow() { stats_.overflows++; }
+    void PrintStats() const;
+
+    inline bool empty() const { return packets_.empty() && local_packets_.empty(); }
+    inline size_t size() const { return packets_.size() + local_packets_.size(); }
+    inline const JitterBufferStats& stats() const { return stats_; }
+    // Whether playback has started and the player should keep popping, even when empty,
+    // so that running dry is seen as an underrun
+    inline bool playing() const { return playing_; }
+    inline int frame_duration() const { return last_frame_duration_; }
+
+private:
+    std::deque<AudioStreamPacket> packets_;
+    std::deque<AudioStreamPacket> local_packets_;
+    JitterBufferStats stats_;
+    int min_depth_;
+    int max_depth_;
+    int underrun_boost_ = 0;
+    int packets_since_underrun_ = 0;
+    // Interarrival jitter in ms scaled by 16, smoothed as in RFC 3550
+    int jitter_q4_ = 0;
+
+    bool playing_ = false;
+    bool segment_boundary_ = false;
+    bool has_next_sequence_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t auto_sequence_ = 0;
+    int64_t last_arrival_ms_ = -1;
+    int64_t buffering_since_ms_ = -1;
+    int64_t starved_at_ms_ = -1;
+    int last_sample_rate_ = 0;
+    int last_frame_duration_ = 0;
+
+    void UpdateTargetDepth(int frame_duration);
+    JitterBufferResult PopServerPacket(AudioStreamPacket& packet, int64_t now_ms);
+};
+
+#endif // JITTER_BUFFER_H
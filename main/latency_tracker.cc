@@ -0,0 +1,162 @@
+#include "latency_tracker.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#define TAG "LatencyTracker"
+
+const uint32_t LatencyTracker::kBucketBounds[LATENCY_BUCKET_COUNT - 1] = {
+    50, 100, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000
+};
+
+const char* const LatencyTracker::kStageNames[kLatencyStageCount] = {
+    "wake_word",
+    "channel_open_start",
+    "channel_open_end",
+    "server_hello",
+    "listening_start",
+    "first_uplink",
+    "tts_start",
+    "first_downlink",
+    "first_output",
+};
+
+void LatencyTracker::BeginTurn(LatencyStage stage) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    BeginTurnLocked(stage);
+}
+
+void LatencyTracker::BeginTurnLocked(LatencyStage stage) {
+    if (marked_stages_.load(std::memory_order_relaxed) != 0) {
+        abandoned_turns_++;
+    }
+    turns_++;
+    turn_start_time_ = esp_timer_get_time();
+    marked_stages_.store(0, std::memory_order_relaxed);
+    Record(stage, turn_start_time_);
+}
+
+void LatencyTracker::MarkOrBeginTurn(LatencyStage stage) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t marked = marked_stages_.load(std::memory_order_relaxed);
+    if (marked == 0 || (marked & (1u << stage))) {
+        BeginTurnLocked(stage);
+    } else {
+        Record(stage, esp_timer_get_time());
+    }
+}
+
+void LatencyTracker::AbandonTurn() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (marked_stages_.load(std::memory_order_relaxed) != 0) {
+        abandoned_turns_++;
+        marked_stages_.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyTracker::Mark(LatencyStage stage) {
+    // Fast path for the per-packet call sites once the stage is recorded
+    uint32_t marked = marked_stages_.load(std::memory_order_relaxed);
+    if (marked == 0 || (marked & (1u << stage))) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    marked = marked_stages_.load(std::memory_order_relaxed);
+    if (marked == 0 || (marked & (1u << stage))) {
+        return;
+    }
+    Record(stage, esp_timer_get_time());
+    if (stage == kLatencyStageFirstOutput) {
+        ESP_LOGI(TAG, "Turn completed in %lld ms", (esp_timer_get_time() - turn_start_time_) / 1000);
+        completed_turns_++;
+        marked_stages_.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyTracker::Record(LatencyStage stage, int64_t now) {
+    uint32_t elapsed_ms = (now - turn_start_time_) / 1000;
+    auto& histogram = histograms_[stage];
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKET_COUNT - 1 && elapsed_ms > kBucketBounds[bucket]) {
+        bucket++;
+    }
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    histogram.total_ms += elapsed_ms;
+    if (elapsed_ms < histogram.min_ms) {
+        histogram.min_ms = elapsed_ms;
+    }
+    if (elapsed_ms > histogram.max_ms) {
+        histogram.max_ms = elapsed_ms;
+    }
+    marked_stages_.fetch_or(1u << stage, std::memory_order_relaxed);
+}
+
+void LatencyTracker::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& histogram : histograms_) {
+        histogram = Histogram();
+    }
+    marked_stages_.store(0, std::memory_order_relaxed);
+    turns_ = 0;
+    completed_turns_ = 0;
+    abandoned_turns_ = 0;
+}
+
+std::string LatencyTracker::GetStatsJson() {
+    /*
+     * 返回各阶段相对于本轮开始的耗时分布（毫秒）
+     * {
+     *     "turns": 10,
+     *     "completed_turns": 8,
+     *     "abandoned_turns": 1,
+     *     "bucket_bounds_ms": [50, 100, ..., 5000],
+     *     "stages": {
+     *         "server_hello": {
+     *             "count": 10, "min": 180, "avg": 260.5, "max": 410,
+     *             "buckets": [0, 0, 0, 4, 6, 0, 0, 0, 0, 0, 0, 0]
+     *         },
+     *         ...
+     *     }
+     * }
+     */
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "turns", turns_);
+    cJSON_AddNumberToObject(root, "completed_turns", completed_turns_);
+    cJSON_AddNumberToObject(root, "abandoned_turns", abandoned_turns_);
+
+    auto bounds = cJSON_CreateArray();
+    for (auto bound : kBucketBounds) {
+        cJSON_AddItemToArray(bounds, cJSON_CreateNumber(bound));
+    }
+    cJSON_AddItemToObject(root, "bucket_bounds_ms", bounds);
+
+    auto stages = cJSON_CreateObject();
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto& histogram = histograms_[i];
+        if (histogram.count == 0) {
+            continue;
+        }
+        auto stage = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stage, "count", histogram.count);
+        cJSON_AddNumberToObject(stage, "min", histogram.min_ms);
+        cJSON_AddNumberToObject(stage, "avg", (double)histogram.total_ms / histogram.count);
+        cJSON_AddNumberToObject(stage, "max", histogram.max_ms);
+        auto buckets = cJSON_CreateArray();
+        for (auto count : histogram.buckets) {
+            cJSON_AddItemToArray(buckets, cJSON_CreateNumber(count));
+        }
+        cJSON_AddItemToObject(stage, "buckets", buckets);
+        cJSON_AddItemToObject(stages, kStageNames[i], stage);
+    }
+    cJSON_AddItemToObject(root, "stages", stages);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
@@ -0,0 +1,83 @@
+#ifndef LATENCY_TRACKER_H
+#define LATENCY_TRACKER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+enum LatencyStage {
+    kLatencyStageWakeWord,
+    kLatencyStageChannelOpenStart,
+    kLatencyStageChannelOpenEnd,
+    kLatencyStageServerHello,
+    kLatencyStageListening,
+    kLatencyStageFirstUplink,
+    kLatencyStageTtsStart,
+    kLatencyStageFirstDownlink,
+    kLatencyStageFirstOutput,
+    kLatencyStageCount
+};
+
+// Upper bounds of the histogram buckets in milliseconds, the last bucket is open ended
+#define LATENCY_BUCKET_COUNT 12
+
+// Traces the stages of a voice turn.
+// A turn starts at the wake word, at the channel open for turns started by a button, or
+// when listening starts again on an open channel, and ends when the first PCM of the
+// reply from the server reaches the codec. Sounds played locally do not end a turn.
+// Turns that go back to idle without a reply are dropped. Each stage is recorded
+// once per turn as the time since the turn started, and aggregated into fixed-bucket
+// histograms, so the cost of a trace is a few counters and no allocation.
+class LatencyTracker {
+public:
+    static LatencyTracker& GetInstance() {
+        static LatencyTracker instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    LatencyTracker(const LatencyTracker&) = delete;
+    LatencyTracker& operator=(const LatencyTracker&) = delete;
+
+    // Starts a new turn at this stage, dropping the unfinished one if any
+    void BeginTurn(LatencyStage stage);
+    // Records the stage if a turn is in progress and the stage is not recorded yet
+    void Mark(LatencyStage stage);
+    // Records the stage in the turn in progress, or starts a new turn at it if there is
+    // none or the stage is already recorded
+    void MarkOrBeginTurn(LatencyStage stage);
+    // Drops the turn in progress, so its stages do not leak into the next turn
+    void AbandonTurn();
+    void Reset();
+    std::string GetStatsJson();
+
+private:
+    LatencyTracker() = default;
+    ~LatencyTracker() = default;
+
+    struct Histogram {
+        uint32_t buckets[LATENCY_BUCKET_COUNT] = {};
+        uint32_t count = 0;
+        uint32_t min_ms = UINT32_MAX;
+        uint32_t max_ms = 0;
+        uint64_t total_ms = 0;
+    };
+
+    static const uint32_t kBucketBounds[LATENCY_BUCKET_COUNT - 1];
+    static const char* const kStageNames[kLatencyStageCount];
+
+    std::mutex mutex_;
+    Histogram histograms_[kLatencyStageCount];
+    // Bit per stage recorded in the current turn, zero when no turn is in progress
+    std::atomic<uint32_t> marked_stages_{0};
+    int64_t turn_start_time_ = 0;
+    uint32_t turns_ = 0;
+    uint32_t completed_turns_ = 0;
+    uint32_t abandoned_turns_ = 0;
+
+    void Record(LatencyStage stage, int64_t now);
+    void BeginTurnLocked(LatencyStage stage);
+};
+
+#endif // LATENCY_TRACKER_H
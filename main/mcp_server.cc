@@ -13,6 +13,11 @@
 #include "application.h"
 #include "display.h"
 #include "board.h"
+#include "latency_tracker.h"
+#include "wake_word_registry.h"
+#if CONFIG_USE_AUDIO_BENCHMARK
+#include "audio_benchmark.h"
+#endif
 
 #define TAG "MCP"
 
@@ -56,6 +61,100 @@ void McpServer::AddCommonTools() {
             return true;
         });
     
+    AddTool("self.get_latency_stats",
+        "Provides the latency histograms of the voice turns since boot, for diagnosing slow responses.\n"
+        "Each stage reports the time in milliseconds since the turn started\n"
+        "(wake word, button, or the start of listening for follow-up turns on an open channel).",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return LatencyTracker::GetInstance().GetStatsJson();
+        });
+
+    AddTool("self.wake_word.get_backends",
+        "Get the wake word detection backends built into the firmware and the one currently selected.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& registry = WakeWordRegistry::GetInstance();
+            cJSON* root = cJSON_CreateObject();
+            cJSON_AddStringToObject(root, "selected", registry.GetSelectedName().c_str());
+            cJSON* backends = cJSON_CreateArray();
+            for (const auto& name : registry.GetNames()) {
+                cJSON_AddItemToArray(backends, cJSON_CreateString(name.c_str()));
+            }
+            cJSON_AddItemToObject(root, "backends", backends);
+            auto json_str = cJSON_PrintUnformatted(root);
+            std::string json(json_str);
+            cJSON_free(json_str);
+            cJSON_Delete(root);
+            return json;
+        });
+
+    AddTool("self.wake_word.set_backend",
+        "Select the wake word detection backend, one of those returned by `self.wake_word.get_backends`.\n"
+        "The device must be rebooted for the new backend to take effect.",
+        PropertyList({
+            Property("backend", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            return WakeWordRegistry::GetInstance().Select(properties["backend"].value<std::string>());
+        });
+
+#if CONFIG_USE_WAKE_WORD_PROFILER
+    AddTool("self.wake_word.get_profile",
+        "Provides the CPU cost of the wake word backend per frame and its detections per hour of microphone audio since boot.\n"
+        "Under `replay` it holds the progress of a running `self.wake_word.replay` (`running` is true), or the result\n"
+        "of the last one.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().GetWakeWordProfiler()->GetStatsJson();
+        });
+
+    AddTool("self.wake_word.replay",
+        "Starts replaying a recorded 16 kHz mono 16-bit PCM file through the wake word backend in real time and\n"
+        "returns right away. The replay takes as long as the recording, poll `self.wake_word.get_profile` for its\n"
+        "progress and, once done, the detection latency, accepts, misses, false accepts per hour and CPU per frame.\n"
+        "The wake word end times are read from `<path>.txt`, in milliseconds, one per line. Only available while the\n"
+        "device is idle, the replay stops early and reports `aborted` if the device leaves idle.",
+        PropertyList({
+            Property("path", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& app = Application::GetInstance();
+            if (app.GetDeviceState() != kDeviceStateIdle) {
+                return "{\"error\":\"The device is not idle\"}";
+            }
+            return app.GetWakeWordProfiler()->StartReplay(properties["path"].value<std::string>());
+        });
+#endif
+
+#if CONFIG_USE_AUDIO_BENCHMARK
+    AddTool("self.audio.run_benchmark",
+        "Starts the audio benchmarks (Opus encode/decode, resampling and sample conversion kernels) in the background\n"
+        "and returns right away, get the results from `self.audio.get_benchmark_results`. Only available while the\n"
+        "device is idle, the benchmarks share the task of the uplink encoder.",
+        PropertyList({
+            Property("iterations", kPropertyTypeInteger, 50, 1, 1000)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            if (Application::GetInstance().GetDeviceState() != kDeviceStateIdle) {
+                return "{\"error\":\"The device is not idle\"}";
+            }
+            if (!AudioBenchmark::StartInBackground(properties["iterations"].value<int>())) {
+                return "{\"error\":\"A benchmark is already running\"}";
+            }
+            return "{\"started\":true}";
+        });
+
+    AddTool("self.audio.get_benchmark_results",
+        "Provides the results of the last `self.audio.run_benchmark`: the CPU cycles, wall time in microseconds per\n"
+        "iteration and peak heap bytes of each benchmark, for tracking performance regressions. `running` is true\n"
+        "while the benchmarks have not finished yet.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return AudioBenchmark::GetLastResultsJson();
+        });
+#endif
+
     auto backlight = board.GetBacklight();
     if (backlight) {
         AddTool("self.screen.set_brightness",
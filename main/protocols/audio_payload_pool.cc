@@ -0,0 +1,55 @@
+#include "audio_payload_pool.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioPayloadPool"
+
+void AudioPayloadPool::Initialize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pool_size_ > 0) {
+        return;
+    }
+#ifdef CONFIG_AUDIO_PAYLOAD_POOL_SIZE
+    pool_size_ = CONFIG_AUDIO_PAYLOAD_POOL_SIZE;
+#endif
+    // Allocate all buffers up front so they sit next to each other instead of
+    // being scattered between short-lived allocations
+    free_buffers_.reserve(pool_size_);
+    for (size_t i = 0; i < pool_size_; i++) {
+        AudioPayload buffer;
+        buffer.reserve(AUDIO_PAYLOAD_BUFFER_SIZE);
+        free_buffers_.emplace_back(std::move(buffer));
+    }
+}
+
+AudioPayload AudioPayloadPool::Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_buffers_.empty()) {
+        auto buffer = std::move(free_buffers_.back());
+        free_buffers_.pop_back();
+        hits_++;
+        return buffer;
+    }
+    misses_++;
+    AudioPayload buffer;
+    buffer.reserve(AUDIO_PAYLOAD_BUFFER_SIZE);
+    return buffer;
+}
+
+void AudioPayloadPool::Release(AudioPayload&& buffer) {
+    if (buffer.capacity() < AUDIO_PAYLOAD_BUFFER_SIZE) {
+        // Moved-from or foreign buffers are not worth keeping
+        return;
+    }
+    buffer.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_buffers_.size() < pool_size_) {
+        free_buffers_.emplace_back(std::move(buffer));
+    }
+}
+
+void AudioPayloadPool::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "free buffers: %u/%u hits: %lu misses: %lu",
+        (unsigned)free_buffers_.size(), (unsigned)pool_size_, (unsigned long)hits_, (unsigned long)misses_);
+}
@@ -0,0 +1,88 @@
+#ifndef AUDIO_PAYLOAD_POOL_H
+#define AUDIO_PAYLOAD_POOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <new>
+
+#include <esp_heap_caps.h>
+
+#define AUDIO_PAYLOAD_BUFFER_SIZE 512
+
+#if CONFIG_AUDIO_PAYLOAD_POOL_IN_PSRAM
+#define AUDIO_PAYLOAD_MEMORY_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define AUDIO_PAYLOAD_MEMORY_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+// Allocates payload storage with heap_caps_malloc in the memory chosen by
+// AUDIO_PAYLOAD_POOL_MEMORY, falling back to any byte-addressable memory
+template <typename T>
+struct AudioPayloadAllocator {
+    using value_type = T;
+
+    AudioPayloadAllocator() = default;
+    template <typename U>
+    AudioPayloadAllocator(const AudioPayloadAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* ptr = heap_caps_malloc(n * sizeof(T), AUDIO_PAYLOAD_MEMORY_CAPS);
+        if (ptr == nullptr) {
+            ptr = heap_caps_malloc(n * sizeof(T), MALLOC_CAP_8BIT);
+        }
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+    void deallocate(T* ptr, size_t) {
+        heap_caps_free(ptr);
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const AudioPayloadAllocator<T>&, const AudioPayloadAllocator<U>&) { return true; }
+template <typename T, typename U>
+inline bool operator!=(const AudioPayloadAllocator<T>&, const AudioPayloadAllocator<U>&) { return false; }
+
+// The Opus payload of an AudioStreamPacket
+using AudioPayload = std::vector<uint8_t, AudioPayloadAllocator<uint8_t>>;
+
+// Recycles the payload buffers of AudioStreamPacket.
+// Buffers are allocated once at startup with AUDIO_PAYLOAD_BUFFER_SIZE capacity, in PSRAM or
+// internal RAM as configured by AUDIO_PAYLOAD_POOL_MEMORY, and handed
+// back and forth between the protocols, the decode queue and PlaySound, so steady-state
+// streaming does not allocate or free a heap block per Opus frame.
+class AudioPayloadPool {
+public:
+    static AudioPayloadPool& GetInstance() {
+        static AudioPayloadPool instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    AudioPayloadPool(const AudioPayloadPool&) = delete;
+    AudioPayloadPool& operator=(const AudioPayloadPool&) = delete;
+
+    // Allocates the pool buffers, call once before the audio tasks start.
+    // Acquire still works without it, every buffer is then a miss
+    void Initialize();
+    // Returns an empty buffer with at least AUDIO_PAYLOAD_BUFFER_SIZE capacity
+    AudioPayload Acquire();
+    // Returns a buffer to the pool, buffers beyond the pool size are freed
+    void Release(AudioPayload&& buffer);
+    void PrintStats();
+
+private:
+    AudioPayloadPool() = default;
+    ~AudioPayloadPool() = default;
+
+    std::mutex mutex_;
+    std::vector<AudioPayload> free_buffers_;
+    size_t pool_size_ = 0;
+    uint32_t hits_ = 0;
+    uint32_t misses_ = 0;
+};
+
+#endif // AUDIO_PAYLOAD_POOL_H
@@ -0,0 +1,133 @@
+#include "loopback_protocol.h"
+#include "latency_tracker.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "LoopbackProtocol"
+
+LoopbackProtocol::LoopbackProtocol() {
+    event_group_handle_ = xEventGroupCreate();
+    xTaskCreate([](void* arg) {
+        auto protocol = (LoopbackProtocol*)arg;
+        protocol->ReplayTask();
+        vTaskDelete(NULL);
+    }, "loopback_replay", 4096, this, 4, &replay_task_handle_);
+}
+
+LoopbackProtocol::~LoopbackProtocol() {
+    if (replay_task_handle_ != nullptr) {
+        vTaskDelete(replay_task_handle_);
+    }
+    vEventGroupDelete(event_group_handle_);
+}
+
+bool LoopbackProtocol::Start() {
+    return true;
+}
+
+bool LoopbackProtocol::OpenAudioChannel() {
+#if CONFIG_LOOPBACK_PROTOCOL_CONNECT_DELAY_MS > 0
+    // Stands in for the TLS connect and the server hello of a real server
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_LOOPBACK_PROTOCOL_CONNECT_DELAY_MS));
+#endif
+    session_id_ = "loopback";
+    server_sample_rate_ = 16000;
+    error_occurred_ = false;
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    LatencyTracker::GetInstance().Mark(kLatencyStageServerHello);
+    channel_opened_ = true;
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+void LoopbackProtocol::CloseAudioChannel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        channel_opened_ = false;
+        recorded_packets_.clear();
+    }
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+bool LoopbackProtocol::IsAudioChannelOpened() const {
+    return channel_opened_ && !error_occurred_;
+}
+
+bool LoopbackProtocol::SendAudio(const AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!channel_opened_ || replaying_) {
+        return channel_opened_;
+    }
+
+    AudioStreamPacket recorded;
+    recorded.sample_rate = packet.sample_rate;
+    recorded.frame_duration = packet.frame_duration;
+    recorded.timestamp = packet.timestamp;
+    recorded.payload = AudioPayloadPool::GetInstance().Acquire();
+    recorded.payload.assign(packet.payload.begin(), packet.payload.end());
+    recorded_packets_.emplace_back(std::move(recorded));
+    if (recorded_packets_.size() >= LOOPBACK_PROTOCOL_MAX_TURN_PACKETS) {
+        replaying_ = true;
+        xEventGroupSetBits(event_group_handle_, LOOPBACK_PROTOCOL_REPLAY_EVENT);
+    }
+    return true;
+}
+
+bool LoopbackProtocol::SendText(const std::string& text) {
+    ESP_LOGD(TAG, "Send: %s", text.c_str());
+    // The end of the user's speech is where a real server would start the reply
+    if (text.find("\"state\":\"stop\"") != std::string::npos) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!recorded_packets_.empty() && !replaying_) {
+            replaying_ = true;
+            xEventGroupSetBits(event_group_handle_, LOOPBACK_PROTOCOL_REPLAY_EVENT);
+        }
+    }
+    return true;
+}
+
+void LoopbackProtocol::SendJson(const char* json) {
+    auto root = cJSON_Parse(json);
+    if (on_incoming_json_ != nullptr) {
+        on_incoming_json_(root);
+    }
+    cJSON_Delete(root);
+}
+
+void LoopbackProtocol::ReplayTask() {
+    while (true) {
+        xEventGroupWaitBits(event_group_handle_, LOOPBACK_PROTOCOL_REPLAY_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        std::deque<AudioStreamPacket> packets;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            packets = std::move(recorded_packets_);
+            recorded_packets_.clear();
+        }
+        ESP_LOGI(TAG, "Replaying %u packets", (unsigned)packets.size());
+
+        SendJson("{\"type\":\"tts\",\"state\":\"start\"}");
+        // Let the main loop switch to speaking before the first packet arrives
+        vTaskDelay(pdMS_TO_TICKS(20));
+        for (auto& packet : packets) {
+            int frame_duration = packet.frame_duration;
+            packet.sequence = ++sequence_;
+            packet.has_sequence = true;
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            if (on_incoming_audio_ != nullptr) {
+                on_incoming_audio_(std::move(packet));
+            }
+            vTaskDelay(pdMS_TO_TICKS(frame_duration));
+        }
+        SendJson("{\"type\":\"tts\",\"state\":\"stop\"}");
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        replaying_ = false;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef _LOOPBACK_PROTOCOL_H_
+#define _LOOPBACK_PROTOCOL_H_
+
+#include "protocol.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <mutex>
+#include <deque>
+
+#define LOOPBACK_PROTOCOL_REPLAY_EVENT (1 << 0)
+// Uplink packets recorded per turn before the reply is played back
+#define LOOPBACK_PROTOCOL_MAX_TURN_PACKETS 50
+
+// A server-less protocol for on-device benchmarks and runs without a network.
+// The audio sent while listening is recorded and, once listening stops or the turn is
+// full, played back as a tts reply at the original frame pace, so the whole
+// encode/queue/decode path runs without a network.
+class LoopbackProtocol : public Protocol {
+public:
+    LoopbackProtocol();
+    ~LoopbackProtocol();
+
+    bool Start() override;
+    bool SendAudio(const AudioStreamPacket& packet) override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+    bool CarriesAudioTimestamps() const override { return true; }
+
+private:
+    EventGroupHandle_t event_group_handle_;
+    TaskHandle_t replay_task_handle_ = nullptr;
+    std::mutex mutex_;
+    std::deque<AudioStreamPacket> recorded_packets_;
+    bool channel_opened_ = false;
+    bool replaying_ = false;
+    uint32_t sequence_ = 0;
+
+    void ReplayTask();
+    void SendJson(const char* json);
+    bool SendText(const std::string& text) override;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "latency_tracker.h"
 
 #include <esp_log.h>
 #include <ml307_mqtt.h>
@@ -214,11 +215,10 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+        // Out of order packets are passed on, the jitter buffer reorders or drops them
         if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
+            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+        } else if (sequence != remote_sequence_ + 1) {
             ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
@@ -231,6 +231,9 @@ bool MqttProtocol::OpenAudioChannel() {
         packet.sample_rate = server_sample_rate_;
         packet.frame_duration = server_frame_duration_;
         packet.timestamp = timestamp;
+        packet.sequence = sequence;
+        packet.has_sequence = true;
+        packet.payload = AudioPayloadPool::GetInstance().Acquire();
         packet.payload.resize(decrypted_size);
         int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet.payload.data());
         if (ret != 0) {
@@ -240,7 +243,9 @@ bool MqttProtocol::OpenAudioChannel() {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
+        if (sequence > remote_sequence_) {
+            remote_sequence_ = sequence;
+        }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -285,6 +290,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
         return;
     }
+    LatencyTracker::GetInstance().Mark(kLatencyStageServerHello);
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
@@ -30,6 +30,7 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    bool CarriesAudioTimestamps() const override { return true; }
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -7,11 +7,16 @@
 #include <chrono>
 #include <vector>
 
+#include "audio_payload_pool.h"
+
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
-    std::vector<uint8_t> payload;
+    AudioPayload payload;
+    uint32_t sequence = 0;
+    bool has_sequence = false;  // Whether the transport carries a sequence number
+    bool local_sound = false;   // Played from the firmware assets by PlaySound, not received from the server
 };
 
 struct BinaryProtocol2 {
@@ -66,6 +71,8 @@ public:
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(const AudioStreamPacket& packet) = 0;
+    // Whether SendAudio passes packet.timestamp on, so that frames left out show up as gaps
+    virtual bool CarriesAudioTimestamps() const { return false; }
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "latency_tracker.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -12,6 +13,12 @@
 
 #define TAG "WS"
 
+static AudioPayload CopyPayload(const uint8_t* data, size_t size) {
+    auto payload = AudioPayloadPool::GetInstance().Acquire();
+    payload.assign(data, data + size);
+    return payload;
+}
+
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
 }
@@ -127,7 +134,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
+                        .payload = CopyPayload(payload, bp2->payload_size)
                     });
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
@@ -138,14 +145,14 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
+                        .payload = CopyPayload(payload, bp3->payload_size)
                     });
                 } else {
                     on_incoming_audio_(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
+                        .payload = CopyPayload((const uint8_t*)data, len)
                     });
                 }
             }
@@ -237,6 +244,7 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
         return;
     }
+    LatencyTracker::GetInstance().Mark(kLatencyStageServerHello);
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
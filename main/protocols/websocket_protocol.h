@@ -20,6 +20,8 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    // Only BinaryProtocol2 has a timestamp field
+    bool CarriesAudioTimestamps() const override { return version_ == 2; }
 
 private:
     EventGroupHandle_t event_group_handle_;
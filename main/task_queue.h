@@ -0,0 +1,218 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Closures up to this size are stored inline, larger ones are boxed on the heap
+#define INLINE_TASK_STORAGE_SIZE 48
+
+// A move-only void() callable with small buffer optimization.
+// Unlike std::function, typical lambdas (this + a few pointers or a std::string)
+// are kept inside the object, so scheduling them does not touch the heap.
+class InlineTask {
+public:
+    InlineTask() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineTask>>>
+    InlineTask(F&& callback) {
+        Assign(std::forward<F>(callback));
+    }
+
+    InlineTask(InlineTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    ~InlineTask() {
+        Reset();
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template<typename T>
+    struct HeapBox {
+        std::unique_ptr<T> callable;
+        void operator()() { (*callable)(); }
+    };
+
+    template<typename T>
+    static const Ops* OpsFor() {
+        static const Ops ops = {
+            [](void* storage) { (*static_cast<T*>(storage))(); },
+            [](void* dst, void* src) {
+                new (dst) T(std::move(*static_cast<T*>(src)));
+                static_cast<T*>(src)->~T();
+            },
+            [](void* storage) { static_cast<T*>(storage)->~T(); },
+        };
+        return &ops;
+    }
+
+    template<typename T>
+    static constexpr bool FitsInline() {
+        return sizeof(T) <= INLINE_TASK_STORAGE_SIZE && alignof(T) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible_v<T>;
+    }
+
+    template<typename F>
+    void Assign(F&& callback) {
+        using T = std::decay_t<F>;
+        if constexpr (FitsInline<T>()) {
+            new (storage_) T(std::forward<F>(callback));
+            ops_ = OpsFor<T>();
+        } else {
+            new (storage_) HeapBox<T>{std::make_unique<T>(std::forward<F>(callback))};
+            ops_ = OpsFor<HeapBox<T>>();
+        }
+    }
+
+    void MoveFrom(InlineTask& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_TASK_STORAGE_SIZE];
+    const Ops* ops_ = nullptr;
+};
+
+// Fixed-capacity multi-producer single-consumer queue of InlineTask.
+// Producers claim a slot with a CAS on the enqueue position and publish it through the
+// per-slot sequence number, so Push never blocks and never allocates. If the ring is
+// full the task goes to an overflow list guarded by its own mutex, which the consumer
+// drains after the ring; this only happens under abnormal load.
+template<size_t Capacity>
+class TaskQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+    TaskQueue() {
+        for (size_t i = 0; i < Capacity; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    void Push(InlineTask&& task) {
+        if (!overflowed_.load(std::memory_order_acquire) && TryPush(task)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        overflow_.emplace_back(std::move(task));
+        overflowed_.store(true, std::memory_order_release);
+        overflow_count_++;
+    }
+
+    // Must only be called from the consumer task
+    bool Pop(InlineTask& task) {
+        Cell& cell = cells_[dequeue_pos_ & (Capacity - 1)];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeue_pos_ + 1) < 0) {
+            return PopOverflow(task);
+        }
+        task = std::move(cell.task);
+        cell.sequence.store(dequeue_pos_ + Capacity, std::memory_order_release);
+        dequeue_pos_++;
+        return true;
+    }
+
+    // Number of tasks that did not fit into the ring since boot
+    size_t overflow_count() const { return overflow_count_; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        InlineTask task;
+    };
+
+    std::array<Cell, Capacity> cells_;
+    std::atomic<size_t> enqueue_pos_{0};
+    size_t dequeue_pos_ = 0;
+
+    std::mutex overflow_mutex_;
+    std::list<InlineTask> overflow_;
+    std::atomic<bool> overflowed_{false};
+    size_t overflow_count_ = 0;
+
+    bool TryPush(InlineTask& task) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & (Capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->task = std::move(task);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool PopOverflow(InlineTask& task) {
+        if (!overflowed_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        if (overflow_.empty()) {
+            overflowed_.store(false, std::memory_order_release);
+            return false;
+        }
+        task = std::move(overflow_.front());
+        overflow_.pop_front();
+        if (overflow_.empty()) {
+            overflowed_.store(false, std::memory_order_release);
+        }
+        return true;
+    }
+};
+
+#endif // TASK_QUEUE_H
@@ -0,0 +1,97 @@
+// Checks the audio kernels bit for bit against the per-sample loops they replaced in
+// NoAudioCodec::Write, NoAudioCodec::Read and Application::ReadAudio.
+#include "audio_kernels.h"
+
+#include "host_test.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// NoAudioCodec::Write before the kernel: 64-bit multiply and clamp per sample
+static void BaselineWrite(const int16_t* data, int32_t* buffer, int samples, int output_volume) {
+    int32_t volume_factor = pow(double(output_volume) / 100.0, 2) * 65536;
+    for (int i = 0; i < samples; i++) {
+        int64_t temp = int64_t(data[i]) * volume_factor;
+        if (temp > INT32_MAX) {
+            buffer[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            buffer[i] = INT32_MIN;
+        } else {
+            buffer[i] = static_cast<int32_t>(temp);
+        }
+    }
+}
+
+// NoAudioCodec::Read before the kernel
+static void BaselineRead(const int32_t* bit32_buffer, int16_t* dest, int samples) {
+    for (int i = 0; i < samples; i++) {
+        int32_t value = bit32_buffer[i] >> 12;
+        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+static void TestScaleToInt32MatchesBaseline() {
+    // Every 16-bit sample value at every volume step
+    std::vector<int16_t> data(65536);
+    for (int i = 0; i < 65536; i++) {
+        data[i] = (int16_t)(i - 32768);
+    }
+    std::vector<int32_t> expected(data.size());
+    std::vector<int32_t> actual(data.size());
+    for (int volume = 0; volume <= 100; volume++) {
+        // Same gain as NoAudioCodec::UpdateVolumeFactor
+        int32_t gain = pow(double(volume) / 100.0, 2) * 65536;
+        BaselineWrite(data.data(), expected.data(), data.size(), volume);
+        ScaleToInt32(data.data(), actual.data(), data.size(), gain);
+        CHECK(actual == expected);
+    }
+}
+
+static void TestShiftToInt16MatchesBaseline() {
+    std::vector<int32_t> data = { INT32_MIN, INT32_MIN + 1, INT32_MAX, INT32_MAX - 1, 0, -1, 1,
+        INT16_MAX << 12, (INT16_MAX + 1) << 12, -(INT16_MAX << 12), -((INT16_MAX + 1) << 12), -((INT16_MAX + 2) << 12) };
+    uint32_t seed = 7;
+    while (data.size() < 100003) {
+        seed = seed * 1664525 + 1013904223;
+        data.push_back((int32_t)seed);
+    }
+    std::vector<int16_t> expected(data.size());
+    std::vector<int16_t> actual(data.size());
+    BaselineRead(data.data(), expected.data(), data.size());
+    ShiftToInt16(data.data(), actual.data(), data.size(), 12);
+    CHECK(actual == expected);
+    // -32768 is never produced
+    CHECK(*std::min_element(actual.begin(), actual.end()) == -INT16_MAX);
+}
+
+static void TestStereoRoundTrip() {
+    // Odd and even frame counts, aligned and unaligned buffers
+    for (size_t frames : { 0, 1, 2, 3, 160, 161, 960 }) {
+        for (size_t misalign = 0; misalign < 2; misalign++) {
+            std::vector<int16_t> stereo(frames * 2 + 1);
+            for (size_t i = 0; i < frames * 2; i++) {
+                stereo[i + misalign] = (int16_t)(i * 7919 - 30000);
+            }
+            std::vector<int16_t> left(frames + 1);
+            std::vector<int16_t> right(frames + 1);
+            DeinterleaveStereo(stereo.data() + misalign, left.data() + misalign, right.data(), frames);
+            for (size_t i = 0; i < frames; i++) {
+                CHECK(left[i + misalign] == stereo[misalign + i * 2]);
+                CHECK(right[i] == stereo[misalign + i * 2 + 1]);
+            }
+
+            std::vector<int16_t> merged(frames * 2 + 1);
+            InterleaveStereo(left.data() + misalign, right.data(), merged.data() + 1 - misalign, frames);
+            CHECK(std::equal(stereo.begin() + misalign, stereo.begin() + misalign + frames * 2, merged.begin() + 1 - misalign));
+        }
+    }
+}
+
+int main() {
+    TestScaleToInt32MatchesBaseline();
+    TestShiftToInt16MatchesBaseline();
+    TestStereoRoundTrip();
+    printf("All audio kernel tests passed\n");
+    return 0;
+}
@@ -0,0 +1,251 @@
+// Runs the ESP-IDF-free stages of the audio pipeline end to end on the host, under the
+// sanitizers when enabled. Opus, the codec and the network are not part of it: raw PCM
+// stands in for the Opus payload, and a scripted network delivers the packets.
+//   downlink: server frames -> payload pool -> jitter buffer -> playout clock -> 24k to 16k resampler
+//   uplink:   48k stereo capture file -> FileAudioCodec -> deinterleave -> 48k to 16k resampler
+//             -> pre-roll ring buffer and output file
+// A recorded capture (raw 16-bit PCM, 1 or 2 channels) replays through the uplink with
+//   audio_pipeline_test <capture.pcm> <sample_rate> <channels> [output.pcm]
+#include "jitter_buffer.h"
+#include "audio_kernels.h"
+#include "pcm_ring_buffer.h"
+#include "polyphase_resampler.h"
+#include "file_audio_codec.h"
+
+#include "host_test.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#define FRAME_MS 60
+
+static std::vector<int16_t> MakeTone(int sample_rate, double frequency, size_t samples, size_t start = 0) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = (int16_t)lround(10000.0 * sin(2.0 * M_PI * frequency * (start + i) / sample_rate));
+    }
+    return pcm;
+}
+
+static AudioStreamPacket MakePacket(uint32_t sequence, const std::vector<int16_t>& pcm) {
+    AudioStreamPacket packet;
+    packet.sample_rate = 24000;
+    packet.frame_duration = FRAME_MS;
+    packet.sequence = sequence;
+    packet.has_sequence = true;
+    packet.payload = AudioPayloadPool::GetInstance().Acquire();
+    auto bytes = reinterpret_cast<const uint8_t*>(pcm.data());
+    packet.payload.assign(bytes, bytes + pcm.size() * sizeof(int16_t));
+    return packet;
+}
+
+static void TestDownlink() {
+    const int frames = 100;
+    const int frame_samples = 24000 * FRAME_MS / 1000;
+    const uint32_t lost_sequence = 40;
+
+    // Arrival times: on pace with up to 40 ms of jitter, 40 never arrives, 61 and 62 swapped
+    struct Arrival {
+        int64_t time_ms;
+        uint32_t sequence;
+    };
+    std::vector<Arrival> arrivals;
+    uint32_t seed = 1;
+    for (uint32_t sequence = 1; sequence <= frames; sequence++) {
+        seed = seed * 1103515245 + 12345;
+        int64_t jitter = (seed >> 16) % 40;
+        if (sequence != lost_sequence) {
+            arrivals.push_back({ (int64_t)sequence * FRAME_MS + jitter, sequence });
+        }
+    }
+    std::swap(arrivals[59].sequence, arrivals[60].sequence);
+
+    JitterBuffer buffer;
+    PolyphaseResampler resampler;
+    resampler.Configure(24000, 16000);
+    std::vector<int16_t> decoded(frame_samples);
+    std::vector<int16_t> output;
+    int played = 0;
+    int concealed = 0;
+    size_t next_arrival = 0;
+
+    // The player ticks every 5 ms and writes one frame every FRAME_MS once playing
+    int64_t next_write_ms = -1;
+    for (int64_t now_ms = 0; now_ms < (frames + 20) * FRAME_MS; now_ms += 5) {
+        while (next_arrival < arrivals.size() && arrivals[next_arrival].time_ms <= now_ms) {
+            uint32_t sequence = arrivals[next_arrival].sequence;
+            buffer.Push(MakePacket(sequence, MakeTone(24000, 440, frame_samples, (sequence - 1) * frame_samples)), now_ms);
+            next_arrival++;
+        }
+        if (next_write_ms >= 0 && now_ms < next_write_ms) {
+            continue;
+        }
+
+        AudioStreamPacket packet;
+        auto result = buffer.Pop(packet, now_ms);
+        if (result == kJitterBufferPacket) {
+            CHECK(packet.payload.size() == frame_samples * sizeof(int16_t));
+            memcpy(decoded.data(), packet.payload.data(), packet.payload.size());
+            AudioPayloadPool::GetInstance().Release(std::move(packet.payload));
+            played++;
+        } else if (result == kJitterBufferLost) {
+            CHECK(packet.payload.empty());
+            std::fill(decoded.begin(), decoded.end(), 0);
+            concealed++;
+        } else {
+            next_write_ms = -1;
+            continue;
+        }
+        size_t offset = output.size();
+        output.resize(offset + resampler.GetOutputSamples(frame_samples));
+        CHECK(resampler.Process(decoded.data(), frame_samples, output.data() + offset) == (int)(output.size() - offset));
+        next_write_ms = (next_write_ms < 0 ? now_ms : next_write_ms) + FRAME_MS;
+    }
+
+    CHECK(played == frames - 1);
+    CHECK(concealed == 1);
+    CHECK(buffer.stats().lost_packets == 1);
+    CHECK(buffer.stats().late_packets == 0);
+    // Playback starts on the first packet, the jitter can starve it once before the depth adapts
+    CHECK(buffer.stats().underruns <= 1);
+    CHECK(buffer.stats().target_depth > 1);
+    // Every frame reached the resampler, in order, so 24 kHz frames became exact 16 kHz frames
+    CHECK(output.size() == (size_t)frames * 16000 * FRAME_MS / 1000);
+
+    // Away from the concealed frame the output is the 440 Hz tone, delayed by the filter
+    int delay = resampler.GetGroupDelayUs() * 16 / 1000;
+    auto reference = MakeTone(16000, 440, output.size() + delay);
+    double error = 0;
+    double energy = 0;
+    for (size_t i = 16000; i < 16000 * 2; i++) {
+        double expected = reference[i - delay];
+        error += (output[i] - expected) * (output[i] - expected);
+        energy += expected * expected;
+    }
+    CHECK(10 * log10(energy / error) > 20);
+    printf("Downlink: %d frames played, %d concealed, target depth %d, jitter %d ms\n",
+        played, concealed, buffer.stats().target_depth, buffer.stats().jitter_ms);
+}
+
+// Reads the capture from the codec in 10 ms blocks, keeps the first channel, resamples it to
+// 16 kHz and writes it to the pre-roll ring and the codec output
+static std::vector<int16_t> RunUplink(FileAudioCodec& codec, PcmRingBuffer& ring) {
+    const int block_frames = codec.input_sample_rate() * 10 / 1000;
+    const int channels = codec.input_channels();
+    CHECK(channels == 1 || channels == 2);
+
+    PolyphaseResampler resampler;
+    bool resample = codec.input_sample_rate() != 16000;
+    if (resample) {
+        resampler.Configure(codec.input_sample_rate(), 16000);
+    }
+    std::vector<int16_t> capture(block_frames * channels);
+    std::vector<int16_t> mic(block_frames);
+    std::vector<int16_t> reference(block_frames);
+    std::vector<int16_t> resampled(resample ? resampler.GetOutputSamples(block_frames) : block_frames);
+    std::vector<int16_t> all_output;
+
+    while (codec.InputData(capture)) {
+        if (channels == 2) {
+            DeinterleaveStereo(capture.data(), mic.data(), reference.data(), block_frames);
+        } else {
+            std::copy(capture.begin(), capture.end(), mic.begin());
+        }
+        int samples = block_frames;
+        if (resample) {
+            samples = resampler.Process(mic.data(), block_frames, resampled.data());
+        } else {
+            std::copy(mic.begin(), mic.end(), resampled.begin());
+        }
+        ring.Write(resampled.data(), samples);
+        codec.OutputData(std::span<const int16_t>(resampled.data(), samples));
+        all_output.insert(all_output.end(), resampled.begin(), resampled.begin() + samples);
+    }
+    return all_output;
+}
+
+static void TestUplink() {
+    const int capture_frames = 48000 * 10 / 1000;  // 10 ms blocks from the I2S driver
+    const int blocks = 300;
+    const size_t pre_roll = 16000 * 2;
+
+    // Record a 48k stereo capture, 300 Hz on the microphone and 1 kHz on the reference
+    std::vector<int16_t> stereo(capture_frames * 2);
+    FILE* file = fopen("uplink_capture.pcm", "wb");
+    CHECK(file != nullptr);
+    for (int block = 0; block < blocks; block++) {
+        auto left = MakeTone(48000, 300, capture_frames, block * capture_frames);
+        auto right = MakeTone(48000, 1000, capture_frames, block * capture_frames);
+        InterleaveStereo(left.data(), right.data(), stereo.data(), capture_frames);
+        fwrite(stereo.data(), sizeof(int16_t), stereo.size(), file);
+    }
+    fclose(file);
+
+    PcmRingBuffer ring(16000 * 2200 / 1000);
+    std::vector<int16_t> all_output;
+    {
+        FileAudioCodec codec(48000, 2, 16000, "uplink_capture.pcm", "uplink_output.pcm");
+        CHECK(codec.opened());
+        all_output = RunUplink(codec, ring);
+    }
+    CHECK(all_output.size() == (size_t)blocks * capture_frames / 3);
+
+    // Only the microphone channel went through, block by block like a direct resample of it
+    PolyphaseResampler resampler;
+    resampler.Configure(48000, 16000);
+    std::vector<int16_t> expected;
+    std::vector<int16_t> resampled(resampler.GetOutputSamples(capture_frames));
+    for (int block = 0; block < blocks; block++) {
+        auto left = MakeTone(48000, 300, capture_frames, block * capture_frames);
+        int samples = resampler.Process(left.data(), capture_frames, resampled.data());
+        expected.insert(expected.end(), resampled.begin(), resampled.begin() + samples);
+    }
+    CHECK(all_output == expected);
+
+    // The codec output file holds the same stream
+    std::vector<int16_t> written(all_output.size() + 1);
+    file = fopen("uplink_output.pcm", "rb");
+    CHECK(file != nullptr);
+    CHECK(fread(written.data(), sizeof(int16_t), written.size(), file) == all_output.size());
+    fclose(file);
+    written.resize(all_output.size());
+    CHECK(written == all_output);
+
+    // The pre-roll read after the fact is exactly the last two seconds of the stream
+    auto snapshot = ring.GetSnapshot(pre_roll);
+    CHECK(snapshot.size() == pre_roll);
+    CHECK(snapshot.position == all_output.size() - pre_roll);
+    std::vector<int16_t> pcm(pre_roll);
+    CHECK(ring.Read(snapshot, 0, pcm.data(), pcm.size()));
+    CHECK(std::equal(pcm.begin(), pcm.end(), all_output.end() - pre_roll));
+    printf("Uplink: %zu samples captured, pre-roll of %zu samples intact\n", all_output.size(), pcm.size());
+}
+
+// Replays a recorded capture through the uplink and writes the 16 kHz microphone stream
+static int ReplayCapture(const char* input_path, int sample_rate, int channels, const char* output_path) {
+    FileAudioCodec codec(sample_rate, channels, 16000, input_path, output_path);
+    if (!codec.opened()) {
+        printf("Failed to open %s\n", input_path);
+        return 1;
+    }
+    PcmRingBuffer ring(16000 * 2200 / 1000);
+    int64_t start_ns = HostTimeNs();
+    auto output = RunUplink(codec, ring);
+    int64_t elapsed_ns = HostTimeNs() - start_ns;
+    printf("Replay: %zu ms of capture in %.2f ms, output written to %s\n",
+        output.size() / 16, elapsed_ns / 1e6, output_path);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 4) {
+        return ReplayCapture(argv[1], atoi(argv[2]), atoi(argv[3]), argc >= 5 ? argv[4] : "replay_output.pcm");
+    }
+    AudioPayloadPool::GetInstance().Initialize();
+    TestDownlink();
+    TestUplink();
+    printf("All audio pipeline tests passed\n");
+    return 0;
+}
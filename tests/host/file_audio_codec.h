@@ -0,0 +1,61 @@
+#ifndef FILE_AUDIO_CODEC_H
+#define FILE_AUDIO_CODEC_H
+
+#include <cstdio>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Host stand-in for AudioCodec: the microphone reads raw 16-bit PCM from a recorded capture
+// and the speaker writes raw 16-bit PCM to a file. The firmware AudioCodec needs the I2S
+// driver and esp_timer, so this keeps only its InputData/OutputData interface. Unlike I2S it
+// does not block for the duration of the samples, so replays run as fast as the pipeline.
+class FileAudioCodec {
+public:
+    FileAudioCodec(int input_sample_rate, int input_channels, int output_sample_rate,
+        const std::string& input_path, const std::string& output_path)
+        : input_sample_rate_(input_sample_rate), input_channels_(input_channels), output_sample_rate_(output_sample_rate) {
+        input_file_ = fopen(input_path.c_str(), "rb");
+        if (!output_path.empty()) {
+            output_file_ = fopen(output_path.c_str(), "wb");
+        }
+    }
+    ~FileAudioCodec() {
+        if (input_file_ != nullptr) {
+            fclose(input_file_);
+        }
+        if (output_file_ != nullptr) {
+            fclose(output_file_);
+        }
+    }
+    FileAudioCodec(const FileAudioCodec&) = delete;
+    FileAudioCodec& operator=(const FileAudioCodec&) = delete;
+
+    // False once the capture has no full block left, the tail shorter than a block is dropped
+    bool InputData(std::span<int16_t> data) {
+        if (input_file_ == nullptr) {
+            return false;
+        }
+        return fread(data.data(), sizeof(int16_t), data.size(), input_file_) == data.size();
+    }
+
+    void OutputData(std::span<const int16_t> data) {
+        if (output_file_ != nullptr) {
+            fwrite(data.data(), sizeof(int16_t), data.size(), output_file_);
+        }
+    }
+
+    inline bool opened() const { return input_file_ != nullptr; }
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int input_channels() const { return input_channels_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+
+private:
+    FILE* input_file_ = nullptr;
+    FILE* output_file_ = nullptr;
+    int input_sample_rate_;
+    int input_channels_;
+    int output_sample_rate_;
+};
+
+#endif // FILE_AUDIO_CODEC_H
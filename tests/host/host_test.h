@@ -0,0 +1,21 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+        exit(1); \
+    } \
+} while (0)
+
+// Monotonic time for the host benchmarks
+static inline int64_t HostTimeNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // HOST_TEST_H
@@ -0,0 +1,366 @@
+#include "jitter_buffer.h"
+
+#include "host_test.h"
+
+#include <algorithm>
+#include <vector>
+
+#define FRAME_MS 60
+
+static void PushPacket(JitterBuffer& buffer, uint32_t sequence, int64_t now_ms) {
+    AudioStreamPacket packet;
+    packet.sample_rate = 24000;
+    packet.frame_duration = FRAME_MS;
+    packet.sequence = sequence;
+    packet.has_sequence = true;
+    packet.payload = { 1, 2, 3 };
+    buffer.Push(std::move(packet), now_ms);
+}
+
+static void TestInOrderStream() {
+    JitterBuffer buffer;
+    AudioStreamPacket packet;
+    int64_t now_ms = 0;
+    for (uint32_t sequence = 1; sequence <= 10; sequence++) {
+        PushPacket(buffer, sequence, now_ms);
+        CHECK(buffer.Pop(packet, now_ms) == kJitterBufferPacket);
+        CHECK(packet.sequence == sequence);
+        now_ms += FRAME_MS;
+    }
+    CHECK(buffer.stats().packets == 10);
+    CHECK(buffer.stats().underruns == 0);
+    CHECK(buffer.stats().lost_packets == 0);
+}
+
+static void TestReorderAndLoss() {
+    JitterBuffer buffer;
+    AudioStreamPacket packet;
+    for (uint32_t sequence : { 1u, 3u, 2u, 5u }) {
+        PushPacket(buffer, sequence, 0);
+    }
+    for (uint32_t sequence : { 1u, 2u, 3u }) {
+        CHECK(buffer.Pop(packet, 0) == kJitterBufferPacket);
+        CHECK(packet.sequence == sequence);
+    }
+    // 4 is missing, it comes out as an empty frame for concealment
+    CHECK(buffer.Pop(packet, 0) == kJitterBufferLost);
+    CHECK(packet.payload.empty());
+    CHECK(!packet.has_sequence);
+    CHECK(buffer.Pop(packet, 0) == kJitterBufferPacket);
+    CHECK(packet.sequence == 5);
+    // 4 arriving now is too late
+    PushPacket(buffer, 4, 0);
+    CHECK(buffer.stats().late_packets == 1);
+    CHECK(buffer.stats().lost_packets == 1);
+}
+
+static void TestZeroSequenceIsASequence() {
+    JitterBuffer buffer;
+    AudioStreamPacket packet;
+    PushPacket(buffer, 0, 0);
+    PushPacket(buffer, 1, 0);
+    CHECK(buffer.Pop(packet, 0) == kJitterBufferPacket);
+    CHECK(packet.sequence == 0);
+    CHECK(buffer.Pop(packet, 0) == kJitterBufferPacket);
+    CHECK(packet.sequence == 1);
+    CHECK(buffer.stats().lost_packets == 0);
+}
+
+static void TestStarvationRebuffers() {
+    JitterBuffer buffer;
+    AudioStreamPacket packet;
+    int64_t now_ms = 0;
+    uint32_t sequence = 1;
+    for (; sequence <= 5; sequence++) {
+        PushPacket(buffer, sequence, now_ms);
+        CHECK(buffer.Pop(packet, now_ms) == kJitterBufferPacket);
+        now_ms += FRAME_MS;
+    }
+    int target_depth = buffer.stats().target_depth;
+    CHECK(buffer.playing());
+
+    // The network stalls and the player's deadline passes with nothing to play,
+    // AudioOutputLoop pops anyway so that the buffer notices
+    CHECK(buffer.Pop(packet, now_ms) == kJitterBufferEmpty);
+    CHECK(!buffer.playing());
+    now_ms += 300;
+
+    // The burst after the stall is counted as an underrun and deepens the buffer
+    PushPacket(buffer, sequence++, now_ms);
+    CHECK(buffer.stats().underruns == 1);
+    CHECK(buffer.stats().target_depth > target_depth);
+    target_depth = buffer.stats().target_depth;
+
+    // Playback holds back until the target depth is buffered again
+    CHECK(buffer.Pop(packet, now_ms) == kJitterBufferBuffering);
+    for (int i = 1; i < target_depth; i++) {
+        now_ms += 10;
+        PushPacket(buffer, sequence++, now_ms);
+    }
+    CHECK(buffer.Pop(packet, now_ms) == kJitterBufferPacket);
+    CHECK(buffer.playing());
+}
+
+static void TestStarvationEndOfStream() {
+    JitterBuffer buffer;
+    AudioStreamPacket packet;
+    PushPacket(buffer, 1, 0);
+    CHECK(buffer.Pop(packet, 0) == kJitterBufferPacket);
+    CHECK(buffer.Pop(packet, FRAME_MS) == kJitterBufferEmpty);
+    // A new stream long after the last one is not an underrun
+    PushPacket(buffer, 2, 5000);
+    CHECK(buffer.stats().underruns == 0);
+}
+
+// Trace replay: packets arrive at scripted times, and a player modelled on
+// AudioOutputLoop takes one frame every FRAME_MS once playing, checking every 5 ms
+struct TraceEvent {
+    int64_t arrival_ms;
+    uint32_t sequence;
+    bool boundary_before = false;  // A sentence_start precedes this packet
+};
+
+struct ReplayResult {
+    int played = 0;
+    int concealed = 0;
+    int max_target_depth = 0;
+    double average_latency_ms = 0;  // From arrival to playout, averaged over the played packets
+    int64_t max_latency_ms = 0;
+};
+
+static ReplayResult ReplayTrace(JitterBuffer& buffer, const std::vector<TraceEvent>& trace) {
+    ReplayResult result;
+    std::vector<int64_t> arrival_of(trace.size() * 2 + 2, -1);
+    size_t next_event = 0;
+    int64_t next_write_ms = -1;
+    int64_t total_latency_ms = 0;
+    int64_t end_ms = trace.back().arrival_ms + 2000;
+    for (int64_t now_ms = 0; now_ms < end_ms; now_ms += 5) {
+        while (next_event < trace.size() && trace[next_event].arrival_ms <= now_ms) {
+            auto& event = trace[next_event++];
+            if (event.boundary_before) {
+                buffer.MarkSegmentBoundary();
+            }
+            if (event.sequence < arrival_of.size()) {
+                arrival_of[event.sequence] = now_ms;
+            }
+            PushPacket(buffer, event.sequence, now_ms);
+            result.max_target_depth = std::max(result.max_target_depth, buffer.stats().target_depth);
+        }
+        if (next_write_ms >= 0 && now_ms < next_write_ms) {
+            continue;
+        }
+        AudioStreamPacket packet;
+        auto pop = buffer.Pop(packet, now_ms);
+        if (pop == kJitterBufferPacket) {
+            int64_t latency_ms = now_ms - arrival_of[packet.sequence];
+            total_latency_ms += latency_ms;
+            result.max_latency_ms = std::max(result.max_latency_ms, latency_ms);
+            result.played++;
+        } else if (pop == kJitterBufferLost) {
+            result.concealed++;
+        } else {
+            next_write_ms = -1;
+            continue;
+        }
+        next_write_ms = (next_write_ms < 0 ? now_ms : next_write_ms) + FRAME_MS;
+    }
+    result.average_latency_ms = result.played > 0 ? (double)total_latency_ms / result.played : 0;
+    return result;
+}
+
+// Packets sent on the frame pace, delayed by up to max_jitter_ms at random
+static std::vector<TraceEvent> MakeJitterTrace(int packets, int max_jitter_ms, uint32_t seed) {
+    std::vector<TraceEvent> trace;
+    for (int i = 1; i <= packets; i++) {
+        seed = seed * 1103515245 + 12345;
+        int jitter = max_jitter_ms > 0 ? (int)((seed >> 16) % max_jitter_ms) : 0;
+        trace.push_back({ (int64_t)i * FRAME_MS + jitter, (uint32_t)i });
+    }
+    std::stable_sort(trace.begin(), trace.end(), [](const TraceEvent& a, const TraceEvent& b) {
+        return a.arrival_ms < b.arrival_ms;
+    });
+    return trace;
+}
+
+static void PrintReplay(const char* name, const JitterBuffer& buffer, const ReplayResult& result) {
+    printf("%-16s played %3d concealed %2d underruns %2lu late %2lu target depth %d (max %d) latency avg %.0f ms max %lld ms\n",
+        name, result.played, result.concealed, (unsigned long)buffer.stats().underruns,
+        (unsigned long)buffer.stats().late_packets, buffer.stats().target_depth, result.max_target_depth,
+        result.average_latency_ms, (long long)result.max_latency_ms);
+}
+
+static void TestTraceSteadyNetwork() {
+    // 20 ms of jitter on 60 ms frames is absorbed without growing the buffer
+    JitterBuffer buffer;
+    auto result = ReplayTrace(buffer, MakeJitterTrace(300, 20, 1));
+    PrintReplay("steady", buffer, result);
+    CHECK(result.played == 300);
+    CHECK(buffer.stats().underruns <= 1);
+    CHECK(result.max_target_depth <= 3);
+    CHECK(result.average_latency_ms < 2 * FRAME_MS);
+}
+
+static void TestTraceBurstyNetwork() {
+    // Every 50 packets the network stalls for 400 ms, then the backlog arrives at once
+    std::vector<TraceEvent> trace;
+    for (int i = 1; i <= 300; i++) {
+        int64_t due = (int64_t)i * FRAME_MS;
+        int64_t stall_end = (int64_t)(i / 50) * 50 * FRAME_MS + 400;
+        trace.push_back({ i >= 50 ? std::max(due, stall_end) : due, (uint32_t)i });
+    }
+    JitterBuffer buffer;
+    auto result = ReplayTrace(buffer, trace);
+    PrintReplay("bursty", buffer, result);
+    CHECK(result.played == 300);
+    // The first stalls starve playback and deepen the buffer, which then rides out the later ones
+    CHECK(buffer.stats().underruns >= 1);
+    CHECK(buffer.stats().underruns <= 2);
+    CHECK(result.max_target_depth > 2);
+    CHECK(result.max_latency_ms <= 8 * FRAME_MS);
+}
+
+static void TestTraceLossAndReordering() {
+    auto trace = MakeJitterTrace(300, 30, 2);
+    // Drop one packet in 25 and swap neighbours every 40 packets
+    std::vector<TraceEvent> lossy;
+    int dropped = 0;
+    for (auto& event : trace) {
+        if (event.sequence % 25 == 13) {
+            dropped++;
+            continue;
+        }
+        lossy.push_back(event);
+    }
+    for (size_t i = 40; i + 1 < lossy.size(); i += 40) {
+        std::swap(lossy[i].sequence, lossy[i + 1].sequence);
+    }
+    JitterBuffer buffer;
+    auto result = ReplayTrace(buffer, lossy);
+    PrintReplay("loss+reorder", buffer, result);
+    CHECK(result.played == 300 - dropped);
+    // Each dropped packet is concealed once, the swapped ones are put back in order
+    CHECK(result.concealed == dropped);
+    CHECK((int)buffer.stats().lost_packets == dropped);
+    CHECK(buffer.stats().late_packets == 0);
+    CHECK(result.max_latency_ms <= 8 * FRAME_MS);
+}
+
+static void TestTraceSentenceGaps() {
+    // Ten sentences of 20 packets with a 600 ms pause between them while the server
+    // synthesizes the next one, the pauses are not underruns and do not deepen the buffer
+    std::vector<TraceEvent> trace;
+    int64_t time_ms = 0;
+    uint32_t sequence = 1;
+    for (int sentence = 0; sentence < 10; sentence++) {
+        for (int i = 0; i < 20; i++) {
+            time_ms += i == 0 ? 600 : FRAME_MS;
+            trace.push_back({ time_ms, sequence++, i == 0 });
+        }
+    }
+    JitterBuffer buffer;
+    auto result = ReplayTrace(buffer, trace);
+    PrintReplay("sentence gaps", buffer, result);
+    CHECK(result.played == 200);
+    CHECK(buffer.stats().underruns == 0);
+    CHECK(result.max_target_depth <= 2);
+
+    // Without the sentence marks the same pauses read as a starving network
+    for (auto& event : trace) {
+        event.boundary_before = false;
+    }
+    JitterBuffer unmarked;
+    result = ReplayTrace(unmarked, trace);
+    PrintReplay("unmarked gaps", unmarked, result);
+    CHECK(unmarked.stats().underruns > 0);
+}
+
+static void TestClearDropsUnderrunBoost() {
+    JitterBuffer buffer;
+    AudioStreamPacket packet;
+    int64_t now_ms = 0;
+    uint32_t sequence = 1;
+    // Starve the buffer a few times in a row
+    for (int i = 0; i < 3; i++) {
+        PushPacket(buffer, sequence++, now_ms);
+        while (buffer.Pop(packet, now_ms) == kJitterBufferBuffering) {
+            now_ms += 10;
+        }
+        CHECK(buffer.Pop(packet, now_ms + FRAME_MS) == kJitterBufferEmpty);
+        now_ms += 2 * FRAME_MS;
+    }
+    PushPacket(buffer, sequence++, now_ms);
+    CHECK(buffer.stats().underruns == 3);
+    int boosted_depth = buffer.stats().target_depth;
+
+    // The next turn starts from the jitter estimate alone, without the three underrun steps
+    buffer.Clear();
+    PushPacket(buffer, 1, now_ms + 5000);
+    CHECK(buffer.stats().target_depth == boosted_depth - 3);
+    CHECK(buffer.stats().underruns == 3);
+}
+
+// PlaySound packets carry no sequence, numbering them must not collide with the server's
+static void TestLocalSoundsKeepOutOfServerSequence() {
+    JitterBuffer buffer;
+    AudioStreamPacket packet;
+    for (uint32_t sequence = 1; sequence <= 3; sequence++) {
+        PushPacket(buffer, sequence, 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        AudioStreamPacket local;
+        local.sample_rate = 16000;
+        local.frame_duration = FRAME_MS;
+        local.local_sound = true;
+        local.payload = { 9 };
+        buffer.Push(std::move(local), 0);
+    }
+    // The server goes on with 4 and 5, which the local sounds would have been numbered as
+    PushPacket(buffer, 4, 0);
+    PushPacket(buffer, 5, 0);
+    CHECK(buffer.size() == 7);
+
+    // The server stream plays through, then the local sounds
+    for (uint32_t sequence = 1; sequence <= 5; sequence++) {
+        CHECK(buffer.Pop(packet, 0) == kJitterBufferPacket);
+        CHECK(!packet.local_sound);
+        CHECK(packet.sequence == sequence);
+    }
+    for (int i = 0; i < 2; i++) {
+        CHECK(buffer.Pop(packet, 0) == kJitterBufferPacket);
+        CHECK(packet.local_sound);
+    }
+    CHECK(buffer.Pop(packet, 0) == kJitterBufferEmpty);
+    CHECK(buffer.stats().late_packets == 0);
+    CHECK(buffer.stats().lost_packets == 0);
+
+    // A local sound queued while the server stream buffers plays right away, and the stream resumes in order
+    PushPacket(buffer, 6, 1000);
+    AudioStreamPacket local;
+    local.local_sound = true;
+    local.frame_duration = FRAME_MS;
+    buffer.Push(std::move(local), 1000);
+    CHECK(buffer.stats().target_depth > 1);
+    CHECK(buffer.Pop(packet, 1000) == kJitterBufferPacket);
+    CHECK(packet.local_sound);
+    CHECK(buffer.Pop(packet, 1000) == kJitterBufferBuffering);
+    CHECK(buffer.Pop(packet, 1000 + buffer.stats().target_depth * FRAME_MS) == kJitterBufferPacket);
+    CHECK(packet.sequence == 6);
+    CHECK(buffer.stats().late_packets == 0);
+}
+
+int main() {
+    TestInOrderStream();
+    TestReorderAndLoss();
+    TestZeroSequenceIsASequence();
+    TestStarvationRebuffers();
+    TestStarvationEndOfStream();
+    TestClearDropsUnderrunBoost();
+    TestLocalSoundsKeepOutOfServerSequence();
+    TestTraceSteadyNetwork();
+    TestTraceBurstyNetwork();
+    TestTraceLossAndReordering();
+    TestTraceSentenceGaps();
+    printf("All jitter buffer tests passed\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Checks the output counts, passband quality and alias rejection of PolyphaseResampler for every pair of the
+// rates the firmware meets (16, 24, 44.1 and 48 kHz), and times each pair on the host.
+// Build with -DHOST_TESTS_SANITIZE=OFF for meaningful ns/sample figures.
+#include "polyphase_resampler.h"
+
+#include "host_test.h"
+
+#include <cmath>
+#include <vector>
+
+static const int kRates[] = { 16000, 24000, 44100, 48000 };
+
+static std::vector<int16_t> MakeTone(int sample_rate, double frequency, size_t samples) {
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = (int16_t)lround(10000.0 * sin(2.0 * M_PI * frequency * i / sample_rate));
+    }
+    return pcm;
+}
+
+// Fits a sine of the given frequency with free amplitude and phase, so the filter delay
+// does not matter, and returns the signal to residual ratio in dB
+static double MeasureSnr(const std::vector<int16_t>& pcm, size_t begin, size_t end, int sample_rate,
+    double frequency, double* amplitude) {
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+    for (size_t i = begin; i < end; i++) {
+        double s = sin(2.0 * M_PI * frequency * i / sample_rate);
+        double c = cos(2.0 * M_PI * frequency * i / sample_rate);
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += pcm[i] * s;
+        yc += pcm[i] * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / det;
+    double b = (yc * ss - ys * sc) / det;
+    double signal = 0, noise = 0;
+    for (size_t i = begin; i < end; i++) {
+        double fit = a * sin(2.0 * M_PI * frequency * i / sample_rate) + b * cos(2.0 * M_PI * frequency * i / sample_rate);
+        signal += fit * fit;
+        noise += (pcm[i] - fit) * (pcm[i] - fit);
+    }
+    *amplitude = sqrt(a * a + b * b);
+    return 10 * log10(signal / noise);
+}
+
+static void TestRatePair(int input_rate, int output_rate) {
+    PolyphaseResampler resampler;
+    resampler.Configure(input_rate, output_rate);
+    CHECK(resampler.input_sample_rate() == input_rate);
+    CHECK(resampler.output_sample_rate() == output_rate);
+
+    // One second in blocks of uneven sizes, GetOutputSamples must predict each block exactly
+    const int total_input = input_rate;
+    auto input = MakeTone(input_rate, 3400, total_input);
+    std::vector<int16_t> output;
+    const int block_sizes[] = { 160, 1, 441, 960, 7, 2646, 480 };
+    int offset = 0;
+    for (int block = 0; offset < total_input; block++) {
+        int samples = std::min(block_sizes[block % 7], total_input - offset);
+        int expected = resampler.GetOutputSamples(samples);
+        size_t position = output.size();
+        output.resize(position + expected);
+        CHECK(resampler.Process(input.data() + offset, samples, output.data() + position) == expected);
+        offset += samples;
+    }
+    // The stream as a whole yields ceil(N * out / in) samples, whatever the block split
+    int64_t exact = ((int64_t)total_input * output_rate + input_rate - 1) / input_rate;
+    CHECK((int64_t)output.size() == exact);
+
+    // Skip the filter warm-up, the passband tone comes through at unity gain
+    double amplitude = 0;
+    double snr = MeasureSnr(output, output_rate / 10, output.size(), output_rate, 3400, &amplitude);
+    CHECK(snr > 40);
+    CHECK(fabs(20 * log10(amplitude / 10000.0)) < 0.5);
+
+    // 60 ms frames, as the firmware feeds them
+    const int frame_samples = input_rate * 60 / 1000;
+    std::vector<int16_t> frame_output(resampler.GetOutputSamples(frame_samples) + 1);
+    resampler.Reset();
+    const int iterations = 200;
+    int64_t start = HostTimeNs();
+    for (int i = 0; i < iterations; i++) {
+        resampler.Process(input.data(), frame_samples, frame_output.data());
+    }
+    double ns_per_sample = (double)(HostTimeNs() - start) / ((double)iterations * frame_samples);
+    printf("%5d -> %5d Hz: %zu samples, SNR %.1f dB, gain %+.2f dB, %.1f ns/input sample\n", input_rate, output_rate,
+        output.size(), snr, 20 * log10(amplitude / 10000.0), ns_per_sample);
+}
+
+// Downsampling must not fold a tone just above the output Nyquist back into the band
+static void TestAliasRejection(int input_rate, int output_rate) {
+    double frequency = output_rate * 0.5 * 1.2;
+    if (output_rate >= input_rate || frequency >= input_rate * 0.5) {
+        return;
+    }
+    PolyphaseResampler resampler;
+    resampler.Configure(input_rate, output_rate);
+    auto input = MakeTone(input_rate, frequency, input_rate);
+    std::vector<int16_t> output(resampler.GetOutputSamples(input.size()));
+    resampler.Process(input.data(), input.size(), output.data());
+    double energy = 0;
+    size_t begin = output.size() / 10;
+    for (size_t i = begin; i < output.size(); i++) {
+        energy += (double)output[i] * output[i];
+    }
+    // Relative to the input tone power, 10000^2 / 2
+    double attenuation = 10 * log10(energy / (output.size() - begin) / 5e7);
+    CHECK(attenuation < -40);
+    printf("%5d -> %5d Hz: %.0f Hz alias at %.1f dB\n", input_rate, output_rate, frequency, attenuation);
+}
+
+static void TestResetClearsHistory() {
+    PolyphaseResampler resampler;
+    resampler.Configure(16000, 24000);
+    auto input = MakeTone(16000, 1000, 960);
+    std::vector<int16_t> first(resampler.GetOutputSamples(960));
+    resampler.Process(input.data(), 960, first.data());
+    resampler.Reset();
+    std::vector<int16_t> second(resampler.GetOutputSamples(960));
+    CHECK(second.size() == first.size());
+    resampler.Process(input.data(), 960, second.data());
+    CHECK(first == second);
+}
+
+int main() {
+    for (int input_rate : kRates) {
+        for (int output_rate : kRates) {
+            if (input_rate != output_rate) {
+                TestRatePair(input_rate, output_rate);
+                TestAliasRejection(input_rate, output_rate);
+            }
+        }
+    }
+    TestResetClearsHistory();
+    printf("All polyphase resampler tests passed\n");
+    return 0;
+}
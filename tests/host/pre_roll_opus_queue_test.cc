@@ -0,0 +1,103 @@
+// Checks that the wake word pre-roll queue keeps only the last pre-roll while idle,
+// and everything once the pre-roll is being sent.
+#include "pre_roll_opus_queue.h"
+
+#include "host_test.h"
+
+#include <thread>
+#include <vector>
+
+// 2000 ms of 60 ms packets, as WAKE_WORD_PRE_ROLL_PACKETS
+#define PRE_ROLL_PACKETS 33
+
+static std::vector<uint8_t> MakePacket(int index) {
+    return { (uint8_t)index, (uint8_t)(index >> 8), 0xfc };
+}
+
+static void TestIdleKeepsLastPreRoll() {
+    PreRollOpusQueue queue(PRE_ROLL_PACKETS);
+    // Minutes of idle encoding
+    const int packets = 5000;
+    for (int i = 0; i < packets; i++) {
+        queue.Push(MakePacket(i));
+        CHECK(queue.size() <= PRE_ROLL_PACKETS);
+    }
+    CHECK(queue.size() == PRE_ROLL_PACKETS);
+
+    // On detection the sender gets the newest packets in order, then the end marker
+    queue.Freeze();
+    queue.Push(std::vector<uint8_t>());
+    std::vector<uint8_t> opus;
+    for (int i = packets - PRE_ROLL_PACKETS; i < packets; i++) {
+        CHECK(queue.Pop(opus));
+        CHECK(opus == MakePacket(i));
+    }
+    CHECK(!queue.Pop(opus));
+    CHECK(queue.size() == 0);
+}
+
+static void TestFrozenKeepsEverything() {
+    PreRollOpusQueue queue(PRE_ROLL_PACKETS);
+    for (int i = 0; i < PRE_ROLL_PACKETS; i++) {
+        queue.Push(MakePacket(i));
+    }
+    // Packets encoded after detection come on top of the pre-roll
+    queue.Freeze();
+    for (int i = PRE_ROLL_PACKETS; i < PRE_ROLL_PACKETS + 10; i++) {
+        queue.Push(MakePacket(i));
+    }
+    CHECK(queue.size() == PRE_ROLL_PACKETS + 10);
+
+    // The next detection starts a fresh pre-roll that is trimmed again
+    queue.Clear();
+    CHECK(queue.size() == 0);
+    for (int i = 0; i < PRE_ROLL_PACKETS * 2; i++) {
+        queue.Push(MakePacket(i));
+    }
+    CHECK(queue.size() == PRE_ROLL_PACKETS);
+
+    // A detection right after the restart keeps it frozen
+    queue.Freeze();
+    queue.Clear(false);
+    for (int i = 0; i < PRE_ROLL_PACKETS * 2; i++) {
+        queue.Push(MakePacket(i));
+    }
+    CHECK(queue.size() == PRE_ROLL_PACKETS * 2);
+}
+
+static void TestUnlimited() {
+    PreRollOpusQueue queue;
+    for (int i = 0; i < PRE_ROLL_PACKETS * 3; i++) {
+        queue.Push(MakePacket(i));
+    }
+    CHECK(queue.size() == PRE_ROLL_PACKETS * 3);
+}
+
+static void TestEndMarkerWakesReader() {
+    PreRollOpusQueue queue(PRE_ROLL_PACKETS);
+    for (int i = 0; i < PRE_ROLL_PACKETS; i++) {
+        queue.Push(MakePacket(i));
+    }
+    queue.Freeze();
+    int received = 0;
+    std::thread reader([&]() {
+        std::vector<uint8_t> opus;
+        while (queue.Pop(opus)) {
+            received++;
+        }
+    });
+    // The end marker is queued even though the queue is full
+    queue.Push(MakePacket(PRE_ROLL_PACKETS));
+    queue.Push(std::vector<uint8_t>());
+    reader.join();
+    CHECK(received == PRE_ROLL_PACKETS + 1);
+}
+
+int main() {
+    TestIdleKeepsLastPreRoll();
+    TestFrozenKeepsEverything();
+    TestUnlimited();
+    TestEndMarkerWakesReader();
+    printf("All pre-roll opus queue tests passed\n");
+    return 0;
+}
@@ -0,0 +1,7 @@
+#ifndef HOST_STUB_CJSON_H
+#define HOST_STUB_CJSON_H
+
+// protocol.h only passes cJSON pointers around
+typedef struct cJSON cJSON;
+
+#endif // HOST_STUB_CJSON_H
@@ -0,0 +1,21 @@
+#ifndef HOST_STUB_ESP_HEAP_CAPS_H
+#define HOST_STUB_ESP_HEAP_CAPS_H
+
+#include <cstdlib>
+#include <cstdint>
+
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+// The host has a single heap, every capability is satisfied by malloc
+static inline void* heap_caps_malloc(size_t size, uint32_t caps) {
+    (void)caps;
+    return malloc(size);
+}
+
+static inline void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+#endif // HOST_STUB_ESP_HEAP_CAPS_H
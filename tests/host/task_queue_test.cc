@@ -0,0 +1,247 @@
+// Checks TaskQueue and InlineTask, and compares enqueue/dispatch against the
+// std::list<std::function> queue that Application::Schedule used before.
+#include "task_queue.h"
+
+#include "host_test.h"
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counts heap allocations, so the tests can tell inline storage from boxing
+static std::atomic<size_t> allocations{0};
+
+// Every replaced new form pairs with the matching delete, all on malloc/free. They stay out of
+// line so the compiler never sees free() called on a pointer from a new-expression
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+__attribute__((noinline)) void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void* ptr) noexcept {
+    operator delete(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void* ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+static void TestInlineAndBoxedTasks() {
+    int calls = 0;
+    std::string message = "speaking";
+
+    // A pointer + a short std::string, the typical Schedule closure, is kept inline
+    size_t before = allocations.load();
+    InlineTask small([&calls, message]() { calls += message.size() > 0; });
+    CHECK(allocations.load() == before);
+    before = allocations.load();
+    InlineTask moved(std::move(small));
+    CHECK(!small);
+    CHECK(allocations.load() == before);
+    moved();
+    CHECK(calls == 1);
+
+    // Larger closures are boxed once and moved by pointer
+    struct Large {
+        char data[INLINE_TASK_STORAGE_SIZE + 16];
+    } large = {};
+    large.data[0] = 7;
+    before = allocations.load();
+    InlineTask boxed([&calls, large]() { calls += large.data[0]; });
+    CHECK(allocations.load() - before == 1);
+    InlineTask boxed_moved(std::move(boxed));
+    CHECK(allocations.load() - before == 1);
+    boxed_moved();
+    CHECK(calls == 8);
+}
+
+static void TestRingDoesNotAllocate() {
+    TaskQueue<16> queue;
+    int value = 0;
+    size_t before = allocations.load();
+    for (int i = 0; i < 1000; i++) {
+        queue.Push([&value, i]() { value += i; });
+        InlineTask task;
+        CHECK(queue.Pop(task));
+        task();
+    }
+    CHECK(allocations.load() == before);
+    CHECK(value == 999 * 1000 / 2);
+    CHECK(queue.overflow_count() == 0);
+}
+
+static void TestOverflowKeepsFifoOrder() {
+    TaskQueue<4> queue;
+    std::vector<int> order;
+    // 4 fit into the ring, the next 6 spill into the overflow list
+    for (int i = 0; i < 10; i++) {
+        queue.Push([&order, i]() { order.push_back(i); });
+    }
+    CHECK(queue.overflow_count() == 6);
+
+    // Dispatch part of the ring, then push more while the overflow is still pending
+    InlineTask task;
+    for (int i = 0; i < 2; i++) {
+        CHECK(queue.Pop(task));
+        task();
+    }
+    for (int i = 10; i < 13; i++) {
+        queue.Push([&order, i]() { order.push_back(i); });
+    }
+    while (queue.Pop(task)) {
+        task();
+    }
+    CHECK(order.size() == 13);
+    for (int i = 0; i < 13; i++) {
+        CHECK(order[i] == i);
+    }
+
+    // Once drained, tasks go back into the ring
+    size_t overflows = queue.overflow_count();
+    queue.Push([&order]() { order.push_back(13); });
+    CHECK(queue.overflow_count() == overflows);
+    CHECK(queue.Pop(task));
+    task();
+    CHECK(order.back() == 13);
+    CHECK(!queue.Pop(task));
+}
+
+static void TestMultipleProducers() {
+    // A small ring, so the producers regularly spill into the overflow list
+    TaskQueue<16> queue;
+    const int producers = 4;
+    const int tasks_per_producer = 20000;
+    std::vector<int> last_seen(producers, -1);
+    std::atomic<int> running{producers};
+    bool in_order = true;
+    int executed = 0;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < tasks_per_producer; i++) {
+                queue.Push([&, p, i]() {
+                    // Tasks of one producer run in the order it pushed them
+                    in_order = in_order && last_seen[p] == i - 1;
+                    last_seen[p] = i;
+                    executed++;
+                });
+                // Pause now and then, so the consumer can drain the overflow and the ring is used again
+                if (i % 32 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+            running--;
+        });
+    }
+
+    InlineTask task;
+    while (running.load() > 0 || executed < producers * tasks_per_producer) {
+        if (queue.Pop(task)) {
+            task();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(!queue.Pop(task));
+    CHECK(in_order);
+    CHECK(executed == producers * tasks_per_producer);
+    printf("Multiple producers: %d tasks, %zu through the overflow list\n", executed, queue.overflow_count());
+}
+
+// The queue Application::Schedule used before TaskQueue
+class ListQueue {
+public:
+    void Push(std::function<void()>&& task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    void RunAll() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto tasks = std::move(tasks_);
+        lock.unlock();
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::list<std::function<void()>> tasks_;
+};
+
+static void BenchmarkEnqueueDispatch() {
+    // Bursts of 8 closures holding this + a std::string, as SetDeviceState and the MCP tools schedule
+    const int rounds = 20000;
+    const int burst = 8;
+    // Not const, a const capture would make the closure's move a copy
+    std::string text = "a state name longer than SSO";
+    uint64_t sum = 0;
+
+    TaskQueue<32> queue;
+    size_t before = allocations.load();
+    int64_t start = HostTimeNs();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < burst; i++) {
+            queue.Push([&sum, text]() { sum += text.size(); });
+        }
+        InlineTask task;
+        while (queue.Pop(task)) {
+            task();
+        }
+    }
+    double task_queue_ns = (double)(HostTimeNs() - start) / (rounds * burst);
+    double task_queue_allocations = (double)(allocations.load() - before) / (rounds * burst);
+
+    ListQueue list;
+    before = allocations.load();
+    start = HostTimeNs();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < burst; i++) {
+            list.Push([&sum, text]() { sum += text.size(); });
+        }
+        list.RunAll();
+    }
+    double list_ns = (double)(HostTimeNs() - start) / (rounds * burst);
+    double list_allocations = (double)(allocations.load() - before) / (rounds * burst);
+
+    CHECK(sum == 2ull * rounds * burst * text.size());
+    // The std::string copy in the closure is the only allocation left
+    CHECK(task_queue_allocations < list_allocations);
+    printf("Enqueue + dispatch per task: TaskQueue %.1f ns, %.1f allocations; std::list<std::function> %.1f ns, %.1f allocations\n",
+        task_queue_ns, task_queue_allocations, list_ns, list_allocations);
+}
+
+int main() {
+    TestInlineAndBoxedTasks();
+    TestRingDoesNotAllocate();
+    TestOverflowKeepsFifoOrder();
+    TestMultipleProducers();
+    BenchmarkEnqueueDispatch();
+    printf("All task queue tests passed\n");
+    return 0;
+}